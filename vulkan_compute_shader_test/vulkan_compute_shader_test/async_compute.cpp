@@ -0,0 +1,135 @@
+#include "async_compute.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+
+AsyncCompute::AsyncCompute(ComputeContext& context, const ComputeKernel& kernel, uint32_t maxInFlight)
+    : context(context) {
+    if (context.supportsTimelineSemaphores()) {
+        timelineSemaphore = context.createTimelineSemaphore(lastSignalValue);
+    }
+
+    const uint32_t slotCount = std::min(std::max(maxInFlight, 1u), maxInFlightLimit);
+    for (uint32_t i = 0; i < slotCount; ++i) {
+        slots.push_back(std::make_unique<JobSlot>(context, kernel));
+        freeSlots.push_back(slots.back().get());
+    }
+
+    completionThread = std::thread(&AsyncCompute::completionLoop, this);
+}
+
+AsyncCompute::~AsyncCompute() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobQueued.notify_all();
+    completionThread.join();
+
+    if (timelineSemaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(context.getDevice(), timelineSemaphore, nullptr);
+    }
+}
+
+uint32_t AsyncCompute::getInFlight() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<uint32_t>(inFlight.size());
+}
+
+std::future<std::vector<uint32_t>> AsyncCompute::submit(const std::vector<uint32_t>& input) {
+    Job job;
+    std::future<std::vector<uint32_t>> future = job.result.get_future();
+    if (input.empty()) {
+        job.result.set_value({});
+        return future;
+    }
+
+    const uint32_t maxElements = context.getDeviceProperties().limits.maxStorageBufferRange / sizeof(uint32_t);
+    if (input.size() > maxElements) {
+        throw std::runtime_error("RUNTIME ERROR: Job exceeds maxStorageBufferRange");
+    }
+    job.elements = static_cast<uint32_t>(input.size());
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        slotAvailable.wait(lock, [this] { return !freeSlots.empty(); });
+        job.slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+
+    // The slot is ours until the completion thread returns it, so it can be
+    // filled and submitted without holding the lock
+    try {
+        job.slot->reserve(job.elements);
+        memcpy(job.slot->getUploadData(), input.data(), job.elements * sizeof(uint32_t));
+        if (timelineSemaphore != VK_NULL_HANDLE) {
+            job.signalValue = lastSignalValue + 1;
+            job.slot->submit(job.elements, timelineSemaphore, job.signalValue);
+            lastSignalValue = job.signalValue;
+        }
+        else {
+            job.slot->submit(job.elements);
+        }
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(job.slot);
+        slotAvailable.notify_one();
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        inFlight.push_back(std::move(job));
+    }
+    jobQueued.notify_one();
+    return future;
+}
+
+void AsyncCompute::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    slotAvailable.wait(lock, [this] { return inFlight.empty(); });
+}
+
+void AsyncCompute::completionLoop() {
+    for (;;) {
+        Job* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobQueued.wait(lock, [this] { return stopping || !inFlight.empty(); });
+            if (inFlight.empty()) {
+                return;
+            }
+            // Only this thread pops, so the front job stays put while unlocked
+            job = &inFlight.front();
+        }
+
+        // Resolving strictly oldest-first keeps the futures completing in
+        // submission order, which is also the order the queue retires them in
+        try {
+            if (timelineSemaphore != VK_NULL_HANDLE) {
+                context.waitTimelineSemaphore(timelineSemaphore, job->signalValue);
+            }
+            else {
+                job->slot->wait();
+            }
+
+            const uint32_t* data = static_cast<const uint32_t*>(job->slot->getReadbackData(job->elements));
+            job->result.set_value(std::vector<uint32_t>(data, data + job->elements));
+        }
+        catch (...) {
+            job->result.set_exception(std::current_exception());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeSlots.push_back(job->slot);
+            inFlight.pop_front();
+        }
+        // waitIdle() shares the condition variable, so wake everyone
+        slotAvailable.notify_all();
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "compute_kernel.hpp"
+#include "job_slot.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Non-blocking job submission against a kernel's pipeline. submit() copies the
+// input into a free JobSlot, submits it and returns a future for the output
+// right away; it only blocks while all maxInFlight slots are busy. Every job
+// signals the next value of a single timeline semaphore, and a completion
+// thread waits for those values in submission order, copies the results out,
+// resolves the futures and hands the slots back. Devices without timeline
+// semaphores fall back to each slot's fence.
+//
+// Only submit() touches the queues, and it serializes itself, so it may be
+// called from several threads. Calling kernel.run() concurrently with an
+// AsyncCompute on the same context is not safe: Vulkan queues need external
+// synchronization.
+class AsyncCompute {
+public:
+    static constexpr uint32_t maxInFlightLimit = 8;
+
+    AsyncCompute(ComputeContext& context, const ComputeKernel& kernel, uint32_t maxInFlight = 4);
+    // Waits for every submitted job to resolve
+    ~AsyncCompute();
+
+    AsyncCompute(const AsyncCompute&) = delete;
+    AsyncCompute& operator=(const AsyncCompute&) = delete;
+
+    std::future<std::vector<uint32_t>> submit(const std::vector<uint32_t>& input);
+    // Blocks until every job submitted so far has resolved
+    void waitIdle();
+
+    uint32_t getMaxInFlight() const { return static_cast<uint32_t>(slots.size()); }
+    uint32_t getInFlight() const;
+    bool usesTimelineSemaphore() const { return timelineSemaphore != VK_NULL_HANDLE; }
+
+private:
+    struct Job {
+        JobSlot* slot = nullptr;
+        uint32_t elements = 0;
+        // Timeline value the job signals; unused on the fence path
+        uint64_t signalValue = 0;
+        std::promise<std::vector<uint32_t>> result;
+    };
+
+    void completionLoop();
+
+    ComputeContext& context;
+    VkSemaphore timelineSemaphore = VK_NULL_HANDLE;
+    uint64_t lastSignalValue = 0;
+    std::vector<std::unique_ptr<JobSlot>> slots;
+
+    // Held across a whole submit() so slots are filled and queued in order
+    std::mutex submitMutex;
+    mutable std::mutex mutex;
+    std::condition_variable slotAvailable;
+    std::condition_variable jobQueued;
+    std::vector<JobSlot*> freeSlots;
+    // Oldest first; the front job is the one the completion thread waits on
+    std::deque<Job> inFlight;
+    bool stopping = false;
+    std::thread completionThread;
+};
@@ -0,0 +1,365 @@
+#include "benchmark.hpp"
+#include "compute_kernel.hpp"
+#include "utils.hpp"
+#include "workgroup_tuner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+
+// Sorts the samples and fills in median, p99 and throughput
+static void summarize(std::vector<double>& samples, BenchmarkResult& result) {
+    std::sort(samples.begin(), samples.end());
+    const size_t p99Index = (samples.size() * 99 + 99) / 100 - 1;
+
+    result.medianMicroseconds = samples[samples.size() / 2];
+    result.p99Microseconds = samples[std::min(p99Index, samples.size() - 1)];
+    if (result.medianMicroseconds > 0.0) {
+        // Every element is read once and written once
+        result.gigabytesPerSecond = 2.0 * result.bytes / (result.medianMicroseconds * 1e3);
+    }
+}
+
+static std::vector<uint32_t> makeInput(uint64_t bytes) {
+    const size_t elements = static_cast<size_t>(bytes / sizeof(uint32_t));
+    std::vector<uint32_t> input(elements);
+    for (size_t i = 0; i < elements; ++i) {
+        input[i] = static_cast<uint32_t>(i);
+    }
+    return input;
+}
+
+static bool verifyOutput(const std::vector<uint32_t>& input, const std::vector<uint32_t>& output) {
+    if (input.size() != output.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < input.size(); ++i) {
+        if (output[i] != input[i] * input[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Benchmark::Benchmark(ComputeContext& context, const std::string& shaderPath, const BenchmarkOptions& options)
+    : context(context), shaderPath(shaderPath), options(options), cpuKernel(&threadPool) {
+    if (this->options.sizes.empty()) {
+        this->options.sizes = defaultSizes();
+    }
+    if (this->options.workgroupSizes.empty()) {
+        this->options.workgroupSizes = WorkgroupTuner::candidateSizes(context.getDeviceProperties().limits);
+    }
+    if (this->options.memoryModes.empty()) {
+        for (MemoryMode mode : { MemoryMode::HostVisible, MemoryMode::HostCached, MemoryMode::DeviceLocal }) {
+            if (context.isMemoryModeSupported(mode)) {
+                this->options.memoryModes.push_back(mode);
+            }
+        }
+    }
+    this->options.iterations = std::max(this->options.iterations, 1u);
+    std::sort(this->options.sizes.begin(), this->options.sizes.end());
+}
+
+std::vector<uint64_t> Benchmark::defaultSizes() {
+    std::vector<uint64_t> sizes;
+    for (uint64_t size = 4ull << 10; size <= 4ull << 30; size *= 4) {
+        sizes.push_back(size);
+    }
+    return sizes;
+}
+
+uint64_t Benchmark::parseSize(const std::string& text) {
+    size_t suffixPosition = 0;
+    uint64_t size = std::stoull(text, &suffixPosition);
+    if (suffixPosition < text.size()) {
+        switch (text[suffixPosition]) {
+        case 'k':
+        case 'K':
+            size <<= 10;
+            break;
+        case 'm':
+        case 'M':
+            size <<= 20;
+            break;
+        case 'g':
+        case 'G':
+            size <<= 30;
+            break;
+        default:
+            throw std::runtime_error("RUNTIME ERROR: Invalid size " + text);
+        }
+    }
+    return size;
+}
+
+template <typename Job>
+BenchmarkResult Benchmark::runHost(const std::string& path, uint64_t bytes, Job job) const {
+    using Clock = std::chrono::steady_clock;
+
+    BenchmarkResult result;
+    result.path = path;
+    result.bytes = bytes;
+    result.verified = true;
+
+    for (uint32_t i = 0; i < options.warmupIterations; ++i) {
+        job();
+    }
+    std::vector<double> samples(options.iterations);
+    for (uint32_t i = 0; i < options.iterations; ++i) {
+        auto start = Clock::now();
+        job();
+        samples[i] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+    summarize(samples, result);
+    return result;
+}
+
+const std::vector<BenchmarkResult>& Benchmark::run() {
+    using Clock = std::chrono::steady_clock;
+
+    const VkPhysicalDeviceLimits& limits = context.getDeviceProperties().limits;
+    results.clear();
+
+    std::vector<uint32_t> output;
+    for (uint64_t bytes : options.sizes) {
+        // The largest default sizes need 8 GB of host memory for input and output
+        std::vector<uint32_t> input;
+        try {
+            input = makeInput(bytes);
+            output.resize(input.size());
+        }
+        catch (const std::bad_alloc&) {
+            for (const char* path : { "host", "cpu" }) {
+                BenchmarkResult result;
+                result.path = path;
+                result.bytes = bytes;
+                result.skipped = "out of host memory";
+                results.push_back(result);
+            }
+            std::cout << "host " << bytes << " bytes: skipped (out of host memory)" << std::endl;
+            continue;
+        }
+
+        // Same work as the shader, including writing a separate output buffer
+        results.push_back(runHost("host", bytes, [&]() {
+            for (size_t i = 0; i < input.size(); ++i) {
+                output[i] = input[i] * input[i];
+            }
+        }));
+        std::cout << "host " << bytes << " bytes: " << results.back().medianMicroseconds << " us" << std::endl;
+
+        results.push_back(runHost("cpu", bytes, [&]() { cpuKernel.run(input, output); }));
+        results.back().verified = verifyOutput(input, output);
+        std::cout << "cpu " << bytes << " bytes: " << results.back().medianMicroseconds << " us" << std::endl;
+    }
+
+    // One kernel per memory mode, so buffers only grow as the sizes go up and
+    // at most one mode's buffers are alive at a time
+    for (MemoryMode requestedMode : options.memoryModes) {
+        std::unique_ptr<ComputeKernel> kernel;
+
+        for (uint64_t bytes : options.sizes) {
+            if (!kernel) {
+                kernel = std::make_unique<ComputeKernel>(context, shaderPath, requestedMode, options.workgroupSizes.front());
+            }
+            // Checked before the input is built, so sizes the device cannot
+            // bind (such as 4 GB) cost no host memory
+            const char* skipped = nullptr;
+            std::vector<uint32_t> input;
+            if (bytes > limits.maxStorageBufferRange) {
+                skipped = "exceeds maxStorageBufferRange";
+            }
+            else {
+                try {
+                    input = makeInput(bytes);
+                    output.resize(input.size());
+                }
+                catch (const std::bad_alloc&) {
+                    skipped = "out of host memory";
+                }
+            }
+
+            for (uint32_t workgroupSize : options.workgroupSizes) {
+                BenchmarkResult result;
+                result.path = "gpu";
+                result.memoryMode = kernel->getMemoryMode();
+                result.workgroupSize = workgroupSize;
+                result.bytes = bytes;
+
+                if (skipped != nullptr) {
+                    result.skipped = skipped;
+                    results.push_back(result);
+                    continue;
+                }
+                if (workgroupSize == 0 || workgroupSize > ComputeKernel::maxWorkgroupSize(limits)) {
+                    result.skipped = "workgroup size outside device limits";
+                    results.push_back(result);
+                    continue;
+                }
+
+                try {
+                    kernel->setWorkgroupSize(workgroupSize);
+
+                    for (uint32_t i = 0; i < options.warmupIterations; ++i) {
+                        kernel->run(input, output);
+                    }
+                    // Checked outside the timed loop, against the same formula the host baseline uses
+                    kernel->run(input, output);
+                    result.verified = verifyOutput(input, output);
+
+                    std::vector<double> samples(options.iterations);
+                    std::vector<double> dispatchSamples(options.iterations);
+                    for (uint32_t i = 0; i < options.iterations; ++i) {
+                        auto start = Clock::now();
+                        kernel->run(input, output);
+                        samples[i] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+                        dispatchSamples[i] = kernel->getLastDispatchMilliseconds() * 1000.0;
+                    }
+                    summarize(samples, result);
+                    if (kernel->hasGpuTimestamps()) {
+                        std::sort(dispatchSamples.begin(), dispatchSamples.end());
+                        result.dispatchMedianMicroseconds = dispatchSamples[dispatchSamples.size() / 2];
+                    }
+                }
+                catch (const std::exception& e) {
+                    // Typically out of device or host memory; later sizes get a fresh kernel
+                    result.skipped = e.what();
+                    results.push_back(result);
+                    kernel.reset();
+                    break;
+                }
+
+                std::cout << "gpu " << memoryModeName(result.memoryMode) << " wg " << workgroupSize << " " << bytes <<
+                    " bytes: " << result.medianMicroseconds << " us" << (result.verified ? "" : " (MISMATCH)") << std::endl;
+                results.push_back(result);
+            }
+        }
+    }
+    std::cout << std::endl;
+
+    return results;
+}
+
+void Benchmark::printSummary(std::ostream& out) const {
+    out << std::left << std::setw(6) << "path" << std::setw(24) << "memory" << std::setw(6) << "wg" <<
+        std::right << std::setw(12) << "bytes" << std::setw(14) << "median us" << std::setw(14) << "p99 us" <<
+        std::setw(10) << "GB/s" << std::setw(14) << "dispatch us" << "  result" << std::endl;
+
+    for (const BenchmarkResult& result : results) {
+        out << std::left << std::setw(6) << result.path <<
+            std::setw(24) << (result.path != "gpu" ? "-" : memoryModeName(result.memoryMode)) <<
+            std::setw(6) << (result.path != "gpu" ? std::string("-") : std::to_string(result.workgroupSize)) <<
+            std::right << std::setw(12) << result.bytes;
+        if (!result.skipped.empty()) {
+            out << "  skipped: " << result.skipped << std::endl;
+            continue;
+        }
+        out << std::fixed << std::setprecision(1) << std::setw(14) << result.medianMicroseconds <<
+            std::setw(14) << result.p99Microseconds << std::setprecision(2) << std::setw(10) << result.gigabytesPerSecond <<
+            std::setprecision(1) << std::setw(14);
+        if (result.dispatchMedianMicroseconds >= 0.0) {
+            out << result.dispatchMedianMicroseconds;
+        }
+        else {
+            out << "-";
+        }
+        out << std::defaultfloat << "  " << (result.verified ? "ok" : "MISMATCH") << std::endl;
+    }
+    out << std::endl;
+
+    // Crossover: the smallest size where the fastest workgroup size beats the host baseline
+    std::vector<MemoryMode> modes;
+    for (const BenchmarkResult& result : results) {
+        if (result.path == "gpu" && std::find(modes.begin(), modes.end(), result.memoryMode) == modes.end()) {
+            modes.push_back(result.memoryMode);
+        }
+    }
+    for (MemoryMode mode : modes) {
+        out << "GPU pays off (" << memoryModeName(mode) << "): ";
+        bool found = false;
+        for (uint64_t bytes : options.sizes) {
+            double hostMedian = 0.0;
+            double bestGpuMedian = 0.0;
+            for (const BenchmarkResult& result : results) {
+                if (result.bytes != bytes || !result.skipped.empty()) {
+                    continue;
+                }
+                if (result.path != "gpu") {
+                    if (hostMedian == 0.0 || result.medianMicroseconds < hostMedian) {
+                        hostMedian = result.medianMicroseconds;
+                    }
+                }
+                else if (result.memoryMode == mode && result.verified &&
+                    (bestGpuMedian == 0.0 || result.medianMicroseconds < bestGpuMedian)) {
+                    bestGpuMedian = result.medianMicroseconds;
+                }
+            }
+            if (bestGpuMedian > 0.0 && bestGpuMedian < hostMedian) {
+                out << "from " << bytes << " bytes" << std::endl;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            out << "not within the measured sizes" << std::endl;
+        }
+    }
+    out << std::endl;
+}
+
+void Benchmark::writeCsv(std::ostream& out) const {
+    const VkPhysicalDeviceProperties& properties = context.getDeviceProperties();
+
+    out << "device,driver_version,path,memory,workgroup_size,bytes,median_us,p99_us,gb_per_s,dispatch_median_us,verified,skipped\n";
+    for (const BenchmarkResult& result : results) {
+        out << csvEscape(properties.deviceName) << "," << properties.driverVersion << "," << result.path << "," <<
+            (result.path != "gpu" ? "" : memoryModeName(result.memoryMode)) << "," << result.workgroupSize << "," <<
+            result.bytes << "," << result.medianMicroseconds << "," << result.p99Microseconds << "," <<
+            result.gigabytesPerSecond << "," << result.dispatchMedianMicroseconds << "," <<
+            (result.verified ? "true" : "false") << "," << csvEscape(result.skipped) << "\n";
+    }
+}
+
+void Benchmark::writeJson(std::ostream& out) const {
+    const VkPhysicalDeviceProperties& properties = context.getDeviceProperties();
+
+    out << "{\n    \"device\": \"" << jsonEscape(properties.deviceName) << "\",\n" <<
+        "    \"driver_version\": " << properties.driverVersion << ",\n" <<
+        "    \"warmup_iterations\": " << options.warmupIterations << ",\n" <<
+        "    \"iterations\": " << options.iterations << ",\n" <<
+        "    \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& result = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "        { \"path\": \"" << result.path <<
+            "\", \"memory\": \"" << (result.path != "gpu" ? "" : memoryModeName(result.memoryMode)) <<
+            "\", \"workgroup_size\": " << result.workgroupSize <<
+            ", \"bytes\": " << result.bytes <<
+            ", \"median_us\": " << result.medianMicroseconds <<
+            ", \"p99_us\": " << result.p99Microseconds <<
+            ", \"gb_per_s\": " << result.gigabytesPerSecond <<
+            ", \"dispatch_median_us\": " << result.dispatchMedianMicroseconds <<
+            ", \"verified\": " << (result.verified ? "true" : "false") <<
+            ", \"skipped\": \"" << jsonEscape(result.skipped) << "\" }";
+    }
+    out << "\n    ]\n}\n";
+}
+
+void Benchmark::writeFile(const std::string& filepath) const {
+    std::ofstream file(filepath, std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to open " + filepath);
+    }
+
+    if (endsWith(filepath, ".csv")) {
+        writeCsv(file);
+    }
+    else {
+        writeJson(file);
+    }
+}
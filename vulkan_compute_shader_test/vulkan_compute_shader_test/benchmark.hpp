@@ -0,0 +1,73 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "cpu_kernel.hpp"
+#include "thread_pool.hpp"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions {
+    // Bytes per input buffer; empty uses defaultSizes()
+    std::vector<uint64_t> sizes;
+    // local_size_x values; empty uses every power-of-two candidate of the device
+    std::vector<uint32_t> workgroupSizes;
+    // Memory placements; empty uses every mode the device supports
+    std::vector<MemoryMode> memoryModes;
+    uint32_t warmupIterations = 2;
+    uint32_t iterations = 10;
+};
+
+struct BenchmarkResult {
+    // "gpu" for the Vulkan path, "host" for the scalar baseline, "cpu" for the
+    // SIMD + thread pool CpuKernel
+    std::string path;
+    MemoryMode memoryMode = MemoryMode::Auto;
+    uint32_t workgroupSize = 0;
+    uint64_t bytes = 0;
+    double medianMicroseconds = 0.0;
+    double p99Microseconds = 0.0;
+    // Input plus output bytes per median run, in 10^9 bytes per second
+    double gigabytesPerSecond = 0.0;
+    // Median of the GPU timestamps around the dispatch; negative when unavailable
+    double dispatchMedianMicroseconds = -1.0;
+    bool verified = false;
+    // Why the configuration was skipped; empty when it ran
+    std::string skipped;
+};
+
+// Sweeps problem size, workgroup size and memory placement over the same
+// kernel.run() path the normal mode uses, plus host-side baselines of the
+// same kernel (scalar and CpuKernel). Input data is a fixed pattern so runs
+// are reproducible, and every GPU configuration is checked once.
+class Benchmark {
+public:
+    Benchmark(ComputeContext& context, const std::string& shaderPath, const BenchmarkOptions& options);
+
+    const std::vector<BenchmarkResult>& run();
+
+    // Prints a table and, per memory mode, the smallest size where the GPU beats
+    // the faster of the two host baselines
+    void printSummary(std::ostream& out) const;
+    void writeCsv(std::ostream& out) const;
+    void writeJson(std::ostream& out) const;
+    // Picks CSV for *.csv paths and JSON otherwise
+    void writeFile(const std::string& filepath) const;
+
+    // 4 KB to 4 GB in steps of 4x
+    static std::vector<uint64_t> defaultSizes();
+    // Accepts plain byte counts and K, M and G suffixes (powers of 1024)
+    static uint64_t parseSize(const std::string& text);
+
+private:
+    template <typename Job>
+    BenchmarkResult runHost(const std::string& path, uint64_t bytes, Job job) const;
+
+    ComputeContext& context;
+    std::string shaderPath;
+    BenchmarkOptions options;
+    std::vector<BenchmarkResult> results;
+    ThreadPool threadPool;
+    CpuKernel cpuKernel;
+};
@@ -0,0 +1,1026 @@
+#include "compute_context.hpp"
+#include "memory_arena.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+
+const char* memoryModeName(MemoryMode mode) {
+    switch (mode) {
+    case MemoryMode::HostVisible:
+        return "host-visible";
+    case MemoryMode::HostCached:
+        return "host-cached";
+    case MemoryMode::DeviceLocal:
+        return "device-local + staging";
+    default:
+        return "auto";
+    }
+}
+
+bool isHostMemoryMode(MemoryMode mode) {
+    return mode == MemoryMode::HostVisible || mode == MemoryMode::HostCached;
+}
+
+VkMemoryPropertyFlags hostMemoryPropertyFlags(MemoryMode mode) {
+    VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    if (mode == MemoryMode::HostCached) {
+        flags |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    }
+    return flags;
+}
+
+HostAccess hostAccessFor(MemoryMode mode, HostAccess access) {
+    return mode == MemoryMode::HostCached ? HostAccess::Readback : access;
+}
+
+ComputeContext::ComputeContext(const ComputeContextOptions& options)
+    : profiler(options.profiler) {
+    // The destructor does not run when a constructor throws, so whatever was
+    // created before the failure (e.g. the instance when --device is out of
+    // range) is released here
+    try {
+        {
+            ScopedPhase phase(profiler, "instance");
+            createInstance(options);
+        }
+        {
+            ScopedPhase phase(profiler, "device_selection");
+            selectPhysicalDevice(options);
+        }
+        {
+            ScopedPhase phase(profiler, "device");
+            createDevice(options);
+        }
+        {
+            ScopedPhase phase(profiler, "pools");
+            createPools();
+        }
+        {
+            ScopedPhase phase(profiler, "pipeline_cache_load");
+            createPipelineCache(options);
+        }
+
+        memoryArena = std::make_unique<MemoryArena>(*this, ArenaMode::FreeList);
+    }
+    catch (...) {
+        destroy();
+        throw;
+    }
+
+    if (profiler != nullptr) {
+        profiler->setInfo("device", deviceProperties.deviceName);
+        profiler->setInfo("vendor_id", std::to_string(deviceProperties.vendorID));
+        profiler->setInfo("device_id", std::to_string(deviceProperties.deviceID));
+        // Driver version encoding is vendor specific, so the raw value is reported
+        profiler->setInfo("driver_version", std::to_string(deviceProperties.driverVersion));
+        profiler->setInfo("api_version", std::to_string(VK_VERSION_MAJOR(deviceProperties.apiVersion)) + "." +
+            std::to_string(VK_VERSION_MINOR(deviceProperties.apiVersion)) + "." +
+            std::to_string(VK_VERSION_PATCH(deviceProperties.apiVersion)));
+        profiler->setInfo("gpu_timestamps", supportsTimestamps() ? "true" : "false");
+        profiler->setInfo("timeline_semaphores", supportsTimelineSemaphores() ? "true" : "false");
+        profiler->setInfo("host_pointer_import", supportsHostPointerImport() ? "true" : "false");
+        profiler->setInfo("memory_budget", supportsMemoryBudget() ? "true" : "false");
+        profiler->setInfo("subgroup_arithmetic", supportsSubgroupArithmetic() ? "true" : "false");
+    }
+}
+
+ComputeContext::~ComputeContext() {
+    vkDeviceWaitIdle(vulkanDevice);
+
+    memoryArena.reset();
+    savePipelineCache();
+    destroy();
+}
+
+void ComputeContext::destroy() {
+    memoryArena.reset();
+    if (vulkanDevice != VK_NULL_HANDLE) {
+        vkDestroyPipelineCache(vulkanDevice, pipelineCache, nullptr);
+        for (VkDescriptorPool pool : descriptorPools) {
+            vkDestroyDescriptorPool(vulkanDevice, pool, nullptr);
+        }
+        vkDestroyCommandPool(vulkanDevice, commandPool, nullptr);
+        if (transferCommandPool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(vulkanDevice, transferCommandPool, nullptr);
+        }
+        vkDestroyDevice(vulkanDevice, nullptr);
+    }
+    if (instance != VK_NULL_HANDLE) {
+        vkDestroyInstance(instance, nullptr);
+    }
+}
+
+// Headless CI machines often have a driver (e.g. lavapipe) but no SDK layers
+static bool isInstanceLayerAvailable(const char* layerName) {
+    uint32_t layerCount = 0;
+    vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+    std::vector<VkLayerProperties> layers(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+
+    for (const auto& layer : layers) {
+        if (strcmp(layer.layerName, layerName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ComputeContext::isDeviceExtensionAvailable(const char* extensionName) const {
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+    for (const auto& extension : extensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ComputeContext::createInstance(const ComputeContextOptions& options) {
+    VkApplicationInfo applicationInfo = {};
+    applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    applicationInfo.pNext = nullptr;
+    applicationInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    applicationInfo.pEngineName = nullptr;
+    applicationInfo.engineVersion = VK_MAKE_VERSION(0, 0, 0);
+    // Ask for 1.2 so timeline semaphores are core, but never for more than the
+    // loader supports: a 1.0 loader rejects any other version
+    instanceApiVersion = VK_API_VERSION_1_0;
+    auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+        vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+    if (enumerateInstanceVersion != nullptr) {
+        uint32_t loaderVersion = VK_API_VERSION_1_0;
+        if (enumerateInstanceVersion(&loaderVersion) == VK_SUCCESS) {
+            instanceApiVersion = std::min(loaderVersion, static_cast<uint32_t>(VK_API_VERSION_1_2));
+        }
+    }
+    applicationInfo.apiVersion = instanceApiVersion;
+
+    const char* validationLayer = "VK_LAYER_KHRONOS_validation" ;
+    const bool enableValidation = options.enableValidation && isInstanceLayerAvailable(validationLayer);
+    if (options.enableValidation && !enableValidation) {
+        std::cout << "Validation layer not available, continuing without it" << std::endl;
+    }
+
+    VkInstanceCreateInfo instanceCreateInfo = {};
+    instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceCreateInfo.pNext = nullptr;
+    instanceCreateInfo.pApplicationInfo = &applicationInfo;
+    instanceCreateInfo.enabledLayerCount = enableValidation ? 1 : 0;
+    instanceCreateInfo.ppEnabledLayerNames = enableValidation ? &validationLayer : nullptr;
+
+    if (vkCreateInstance(&instanceCreateInfo, nullptr, &instance) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create instance");
+    }
+}
+
+static const char* deviceTypeName(VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        return "cpu";
+    default:
+        return "other";
+    }
+}
+
+static uint32_t maxComputeQueueCount(VkPhysicalDevice device) {
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families.data());
+
+    uint32_t queueCount = 0;
+    for (const auto& family : families) {
+        if (family.queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            queueCount = std::max(queueCount, family.queueCount);
+        }
+    }
+    return queueCount;
+}
+
+static VkDeviceSize deviceLocalHeapSize(VkPhysicalDevice device) {
+    VkPhysicalDeviceMemoryProperties memoryProperties = {};
+    vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+
+    VkDeviceSize size = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            size += memoryProperties.memoryHeaps[i].size;
+        }
+    }
+    return size;
+}
+
+uint64_t ComputeContext::scorePhysicalDevice(VkPhysicalDevice device) {
+    VkPhysicalDeviceProperties properties = {};
+    vkGetPhysicalDeviceProperties(device, &properties);
+
+    // Device type dominates; among devices of the same type, more compute
+    // queues and then more device-local memory win
+    uint64_t score = 0;
+    switch (properties.deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        score = 4000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        score = 3000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        score = 2000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        score = 1000;
+        break;
+    default:
+        break;
+    }
+    score += std::min(maxComputeQueueCount(device), 16u) * 32;
+    score += std::min<VkDeviceSize>(deviceLocalHeapSize(device) >> 30, 255);
+    return score;
+}
+
+void ComputeContext::selectPhysicalDevice(const ComputeContextOptions& options) {
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    if (deviceCount == 0) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to find physical device");
+    }
+    std::cout << "Physical device count: " << deviceCount << std::endl << std::endl;
+    std::vector<VkPhysicalDevice> physicalDeviceList(deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDeviceList.data());
+    physicalDeviceCount = deviceCount;
+
+    int selectedDevice = 0;
+    uint64_t bestScore = 0;
+    std::cout << "Available devices: " << std::endl;
+    for (uint32_t deviceNumber = 0; deviceNumber < deviceCount; ++deviceNumber) {
+        VkPhysicalDevice device = physicalDeviceList[deviceNumber];
+        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        const uint64_t score = scorePhysicalDevice(device);
+        std::cout << "   Device(" << deviceNumber << "): " << deviceProperties.deviceName << " (" <<
+            deviceTypeName(deviceProperties.deviceType) << ", " << maxComputeQueueCount(device) << " compute queues, " <<
+            (deviceLocalHeapSize(device) >> 20) << " MB device-local, score " << score << ")" << std::endl;
+        // Ties go to the lower index so the choice is stable across runs
+        if (score > bestScore) {
+            bestScore = score;
+            selectedDevice = static_cast<int>(deviceNumber);
+        }
+    }
+
+    // An explicit index beats the environment, which beats the score
+    std::string selectionReason = "highest score";
+    std::string environmentDevice;
+    int requestedDevice = options.deviceIndex;
+    if (requestedDevice >= 0) {
+        selectionReason = "requested";
+    }
+    else if (getEnvironmentVariable(deviceEnvironmentVariable, environmentDevice) && !environmentDevice.empty()) {
+        try {
+            requestedDevice = std::stoi(environmentDevice);
+        }
+        catch (const std::exception&) {
+            requestedDevice = -1;
+        }
+        if (requestedDevice < 0) {
+            throw std::runtime_error(std::string("RUNTIME ERROR: Invalid ") + deviceEnvironmentVariable + " value: " +
+                environmentDevice);
+        }
+        selectionReason = deviceEnvironmentVariable;
+    }
+    if (requestedDevice >= static_cast<int>(deviceCount)) {
+        throw std::runtime_error("RUNTIME ERROR: Device " + std::to_string(requestedDevice) + " does not exist");
+    }
+    if (requestedDevice >= 0) {
+        selectedDevice = requestedDevice;
+    }
+    std::cout << std::endl;
+
+    physicalDevice = physicalDeviceList[selectedDevice];
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    if (physicalDevice == VK_NULL_HANDLE) {
+        throw std::runtime_error("RUNTIME ERROR: Invalid device (VK_NULL_HANDLE)");
+    }
+
+    // Print physical device info
+    std::cout << deviceProperties.deviceName << " (Device "<< selectedDevice <<") selected (" << selectionReason << ")." << std::endl;
+    std::cout << "    Vulkan version: " << VK_VERSION_MAJOR(deviceProperties.apiVersion) <<
+        "." << VK_VERSION_MINOR(deviceProperties.apiVersion) <<
+        "." << VK_VERSION_PATCH(deviceProperties.apiVersion) << std::endl;
+    std::cout << "    Max compute shared memory size: " << deviceProperties.limits.maxComputeSharedMemorySize / 1024 << "KB" << std::endl << std::endl;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &physicalDeviceMemProps);
+}
+
+void ComputeContext::createDevice(const ComputeContextOptions& options) {
+    // Get compute queue index
+    uint32_t queueFamilyPropCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropCount, nullptr);
+
+    std::cout << "Queue family prop count: " << queueFamilyPropCount << std::endl;
+    std::vector<VkQueueFamilyProperties> queueFamilyPropVec(queueFamilyPropCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropCount, queueFamilyPropVec.data());
+
+    // The first compute family is normally the universal one. When several
+    // queues are wanted, prefer the family that offers the most of them
+    // (often a dedicated async compute family).
+    computeQueueIndex = queueFamilyPropCount;
+    for (uint32_t i = 0; i < queueFamilyPropCount; ++i) {
+        const auto& prop = queueFamilyPropVec[i];
+        if (prop.queueCount > 0 && prop.queueFlags & VK_QUEUE_COMPUTE_BIT &&
+            (computeQueueIndex == queueFamilyPropCount ||
+                (options.computeQueueCount > 1 && prop.queueCount > queueFamilyPropVec[computeQueueIndex].queueCount))) {
+            computeQueueIndex = i;
+        }
+    }
+
+    if (computeQueueIndex == queueFamilyPropCount) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to find a compute queue family");
+    }
+    const uint32_t computeQueueCount = std::min({ std::max(options.computeQueueCount, 1u),
+        queueFamilyPropVec[computeQueueIndex].queueCount, maxComputeQueues });
+    std::cout << "Compute queue family index: " << computeQueueIndex << " (" << computeQueueCount << " of " <<
+        queueFamilyPropVec[computeQueueIndex].queueCount << " queues)" << std::endl;
+
+    // timestampComputeAndGraphics only covers every compute queue; a family can
+    // still report valid bits when it is false
+    timestampValidBits = queueFamilyPropVec[computeQueueIndex].timestampValidBits;
+    if (timestampValidBits == 0) {
+        std::cout << "GPU timestamps: not supported on the compute queue" << std::endl;
+    }
+
+    // Look for a transfer-only queue family (typically the copy engines on discrete GPUs)
+    bool foundTransferQueue = false;
+    for (uint32_t i = 0; i < queueFamilyPropCount && options.enableTransferQueue; ++i) {
+        const auto& prop = queueFamilyPropVec[i];
+        if (prop.queueCount > 0 && (prop.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(prop.queueFlags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT))) {
+            transferQueueIndex = i;
+            foundTransferQueue = true;
+            break;
+        }
+    }
+
+    if (foundTransferQueue) {
+        std::cout << "Transfer queue family index: " << transferQueueIndex << std::endl << std::endl;
+    }
+    else if (options.enableTransferQueue) {
+        std::cout << "Transfer queue family index: none (no transfer-only queue family)" << std::endl << std::endl;
+    }
+    else {
+        std::cout << "Transfer queue family index: none (disabled)" << std::endl << std::endl;
+    }
+
+    // Create vulkan device
+    std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfoVec;
+
+    std::vector<float> queuePriorities(computeQueueCount, 1.0f);
+    VkDeviceQueueCreateInfo deviceQueueCreateInfo = {};
+    deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    deviceQueueCreateInfo.queueFamilyIndex = computeQueueIndex;
+    deviceQueueCreateInfo.queueCount = computeQueueCount;
+    deviceQueueCreateInfo.pQueuePriorities = queuePriorities.data();
+    deviceQueueCreateInfoVec.push_back(deviceQueueCreateInfo);
+
+    if (foundTransferQueue) {
+        deviceQueueCreateInfo.queueFamilyIndex = transferQueueIndex;
+        deviceQueueCreateInfo.queueCount = 1;
+        deviceQueueCreateInfoVec.push_back(deviceQueueCreateInfo);
+    }
+
+    // Timeline semaphores are core in 1.2 and VK_KHR_timeline_semaphore before
+    // that; either way the feature has to be queried and enabled explicitly
+    std::vector<const char*> deviceExtensions;
+    const bool timelineExtensionAvailable = isDeviceExtensionAvailable(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    const bool timelineCore = instanceApiVersion >= VK_API_VERSION_1_2 && deviceProperties.apiVersion >= VK_API_VERSION_1_2;
+
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures = {};
+    timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+
+    if (instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+        (timelineCore || timelineExtensionAvailable)) {
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &timelineSemaphoreFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+    }
+    timelineSemaphoreSupported = timelineSemaphoreFeatures.timelineSemaphore == VK_TRUE;
+    if (timelineSemaphoreSupported && !timelineCore) {
+        deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+    std::cout << "Timeline semaphores: " << (timelineSemaphoreSupported ? (timelineCore ? "core" : "extension") :
+        "not supported, using fences") << std::endl;
+
+    // VK_EXT_external_memory_host builds on the 1.1 external memory types
+    const bool hostImportAvailable = instanceApiVersion >= VK_API_VERSION_1_1 &&
+        deviceProperties.apiVersion >= VK_API_VERSION_1_1 && isDeviceExtensionAvailable(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    if (hostImportAvailable) {
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT externalMemoryHostProperties = {};
+        externalMemoryHostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &externalMemoryHostProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+        minImportedHostPointerAlignment = externalMemoryHostProperties.minImportedHostPointerAlignment;
+        deviceExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+        std::cout << "Host pointer import: supported (alignment " << minImportedHostPointerAlignment << " bytes)" << std::endl;
+    }
+    else {
+        std::cout << "Host pointer import: not supported, mapped files are copied" << std::endl;
+    }
+
+    // Subgroup operations are core in 1.1; shaders using them are built for a
+    // 1.1 target, so they are only an option when both sides are 1.1
+    if (instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1) {
+        VkPhysicalDeviceSubgroupProperties subgroupProperties = {};
+        subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &subgroupProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+        const VkSubgroupFeatureFlags requiredOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+        subgroupSize = subgroupProperties.subgroupSize;
+        subgroupArithmeticSupported = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+            (subgroupProperties.supportedOperations & requiredOperations) == requiredOperations;
+    }
+    if (subgroupArithmeticSupported) {
+        std::cout << "Subgroup arithmetic: supported (subgroup size " << subgroupSize << ")" << std::endl;
+    }
+    else {
+        std::cout << "Subgroup arithmetic: not supported, primitives use shared memory only" << std::endl;
+    }
+
+    // VK_EXT_memory_budget is read through vkGetPhysicalDeviceMemoryProperties2
+    memoryBudgetSupported = instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+        isDeviceExtensionAvailable(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudgetSupported) {
+        deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    printMemoryHeaps();
+    std::cout << std::endl;
+
+    VkDeviceCreateInfo deviceCreateInfo = {};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pNext = timelineSemaphoreSupported ? &timelineSemaphoreFeatures : nullptr;
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(deviceQueueCreateInfoVec.size());
+    deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfoVec.data();
+    deviceCreateInfo.enabledLayerCount = 0;
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.empty() ? nullptr : deviceExtensions.data();
+
+    if (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &vulkanDevice) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create vulkan device");
+    }
+
+    // The core and KHR entry points are interchangeable; the loader only
+    // exports the core names, so both are resolved through the device
+    if (timelineSemaphoreSupported) {
+        const char* waitName = timelineCore ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR";
+        const char* counterName = timelineCore ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR";
+        waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(vulkanDevice, waitName));
+        getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+            vkGetDeviceProcAddr(vulkanDevice, counterName));
+        if (waitSemaphores == nullptr || getSemaphoreCounterValue == nullptr) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to load timeline semaphore functions");
+        }
+    }
+    if (hostImportAvailable) {
+        getMemoryHostPointerProperties = reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+            vkGetDeviceProcAddr(vulkanDevice, "vkGetMemoryHostPointerPropertiesEXT"));
+    }
+
+    computeQueues.resize(computeQueueCount);
+    for (uint32_t i = 0; i < computeQueueCount; ++i) {
+        vkGetDeviceQueue(vulkanDevice, computeQueueIndex, i, &computeQueues[i]);
+    }
+    queue = computeQueues[0];
+    if (foundTransferQueue) {
+        vkGetDeviceQueue(vulkanDevice, transferQueueIndex, 0, &transferQueue);
+    }
+}
+
+void ComputeContext::createPools() {
+    // Command buffers are re-recorded for every job, so they must be individually resettable
+    VkCommandPoolCreateInfo cmdPoolCreateInfo = {};
+    cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    cmdPoolCreateInfo.queueFamilyIndex = computeQueueIndex;
+
+    if (vkCreateCommandPool(vulkanDevice, &cmdPoolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create command pool");
+    }
+
+    if (hasTransferQueue()) {
+        cmdPoolCreateInfo.queueFamilyIndex = transferQueueIndex;
+        if (vkCreateCommandPool(vulkanDevice, &cmdPoolCreateInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create transfer command pool");
+        }
+    }
+
+    addDescriptorPool();
+}
+
+VkDescriptorPool ComputeContext::addDescriptorPool() {
+    // Every owner (kernel, job slot, runner) allocates one set of two storage
+    // buffers; pools of this size are added as owners accumulate
+    const uint32_t setsPerPool = 16;
+
+    VkDescriptorPoolSize descriptorPoolSize = {};
+    descriptorPoolSize.descriptorCount = setsPerPool * 2;
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.maxSets = setsPerPool;
+
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    if (vkCreateDescriptorPool(vulkanDevice, &descriptorPoolCreateInfo, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor pool");
+    }
+    descriptorPools.push_back(pool);
+    return pool;
+}
+
+VkDescriptorSet ComputeContext::allocateDescriptorSet(VkDescriptorSetLayout layout) {
+    std::lock_guard<std::mutex> lock(descriptorPoolMutex);
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &layout;
+
+    // The newest pool is the most likely to have room, but sets freed from
+    // older pools are reused too. Only out-of-pool errors move on; anything
+    // else is a real failure.
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    for (auto pool = descriptorPools.rbegin(); pool != descriptorPools.rend(); ++pool) {
+        descriptorSetAllocateInfo.descriptorPool = *pool;
+        const VkResult result = vkAllocateDescriptorSets(vulkanDevice, &descriptorSetAllocateInfo, &set);
+        if (result == VK_SUCCESS) {
+            descriptorSetPools[set] = *pool;
+            return set;
+        }
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to allocate descriptor sets");
+        }
+    }
+
+    descriptorSetAllocateInfo.descriptorPool = addDescriptorPool();
+    if (vkAllocateDescriptorSets(vulkanDevice, &descriptorSetAllocateInfo, &set) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to allocate descriptor sets");
+    }
+    descriptorSetPools[set] = descriptorSetAllocateInfo.descriptorPool;
+    return set;
+}
+
+void ComputeContext::freeDescriptorSet(VkDescriptorSet set) {
+    if (set == VK_NULL_HANDLE) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(descriptorPoolMutex);
+    auto pool = descriptorSetPools.find(set);
+    if (pool == descriptorSetPools.end()) {
+        return;
+    }
+    vkFreeDescriptorSets(vulkanDevice, pool->second, 1, &set);
+    descriptorSetPools.erase(pool);
+}
+
+// Cache files are keyed by everything that can invalidate the driver's cache data
+static std::string pipelineCacheFileName(const VkPhysicalDeviceProperties& properties) {
+    std::ostringstream name;
+    name << "pipeline_cache_" << std::hex << std::setfill('0') <<
+        std::setw(4) << properties.vendorID << "_" <<
+        std::setw(4) << properties.deviceID << "_" <<
+        std::setw(8) << properties.driverVersion << "_";
+    for (uint32_t i = 0; i < VK_UUID_SIZE; ++i) {
+        name << std::setw(2) << static_cast<uint32_t>(properties.pipelineCacheUUID[i]);
+    }
+    name << ".bin";
+    return name.str();
+}
+
+static bool isPipelineCacheValid(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties, std::string& reason) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header)) {
+        reason = "truncated header";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (header.headerSize < sizeof(header) || header.headerSize > data.size()) {
+        reason = "bad header size";
+        return false;
+    }
+    if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+        reason = "unknown header version";
+        return false;
+    }
+    if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID) {
+        reason = "different device";
+        return false;
+    }
+    if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        reason = "stale pipeline cache UUID";
+        return false;
+    }
+    return true;
+}
+
+void ComputeContext::createPipelineCache(const ComputeContextOptions& options) {
+    std::vector<char> initialData;
+
+    if (!options.pipelineCacheDirectory.empty()) {
+        pipelineCachePath = (std::filesystem::path(options.pipelineCacheDirectory) /
+            pipelineCacheFileName(deviceProperties)).string();
+
+        std::ifstream file{ pipelineCachePath, std::ios::ate | std::ios::binary };
+        if (file.is_open()) {
+            initialData.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(initialData.data(), initialData.size());
+
+            std::string reason;
+            if (!file || !isPipelineCacheValid(initialData, deviceProperties, reason)) {
+                std::cout << "Pipeline cache: discarding " << pipelineCachePath << " (" <<
+                    (file ? reason : std::string("read error")) << ")" << std::endl << std::endl;
+                initialData.clear();
+            }
+        }
+    }
+
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheCreateInfo.initialDataSize = initialData.size();
+    pipelineCacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+    if (vkCreatePipelineCache(vulkanDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create pipeline cache");
+    }
+    pipelineCacheLoadedBytes = initialData.size();
+}
+
+void ComputeContext::savePipelineCache() {
+    if (pipelineCachePath.empty()) {
+        return;
+    }
+
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(vulkanDevice, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+        return;
+    }
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(vulkanDevice, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+        return;
+    }
+
+    // Write to a temporary file first so a crash never leaves a half-written cache behind.
+    // This runs from the destructor, so failures are reported rather than thrown.
+    const std::string tempPath = pipelineCachePath + ".tmp";
+    {
+        std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+        file.write(data.data(), dataSize);
+        if (!file) {
+            std::cerr << "Pipeline cache: failed to write " << tempPath << std::endl;
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, pipelineCachePath, error);
+    if (error) {
+        std::cerr << "Pipeline cache: failed to save " << pipelineCachePath << " (" << error.message() << ")" << std::endl;
+    }
+}
+
+bool ComputeContext::isUnifiedMemory() const {
+    // On UMA devices every device-local memory type can also be mapped by the host
+    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryTypeCount; ++i) {
+        VkMemoryPropertyFlags flags = physicalDeviceMemProps.memoryTypes[i].propertyFlags;
+        if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+MemoryMode ComputeContext::resolveMemoryMode(MemoryMode requested, std::string& reason) const {
+    if (requested == MemoryMode::HostCached && !isMemoryModeSupported(requested)) {
+        reason = "requested host-cached, but no memory type is host-cached";
+        return MemoryMode::HostVisible;
+    }
+    if (requested != MemoryMode::Auto) {
+        reason = "requested";
+        return requested;
+    }
+
+    if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+        reason = "CPU device, device memory is host memory";
+        return MemoryMode::HostVisible;
+    }
+    if (isUnifiedMemory()) {
+        reason = "unified memory, all device-local memory is host-visible";
+        return MemoryMode::HostVisible;
+    }
+
+    reason = "device has dedicated device-local memory";
+    return MemoryMode::DeviceLocal;
+}
+
+bool ComputeContext::isMemoryModeSupported(MemoryMode mode) const {
+    VkMemoryPropertyFlags propertyFlags = 0;
+    switch (mode) {
+    case MemoryMode::HostVisible:
+    case MemoryMode::HostCached:
+        propertyFlags = hostMemoryPropertyFlags(mode);
+        break;
+    case MemoryMode::DeviceLocal:
+        propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        break;
+    default:
+        return true;
+    }
+
+    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryTypeCount; ++i) {
+        if ((physicalDeviceMemProps.memoryTypes[i].propertyFlags & propertyFlags) == propertyFlags) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t ComputeContext::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags propertyFlags) const {
+    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryTypeCount; ++i) {
+        VkMemoryType memoryType = physicalDeviceMemProps.memoryTypes[i];
+        if ((memoryTypeBits & (1u << i)) &&
+            (memoryType.propertyFlags & propertyFlags) == propertyFlags) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("RUNTIME ERROR: Failed to find suitable memory type");
+}
+
+uint32_t ComputeContext::findHostMemoryType(uint32_t memoryTypeBits, HostAccess access) const {
+    // Cached-ness decides first, then coherence (no flush or invalidate
+    // needed), then, for uploads, device-local (resizable BAR) memory
+    uint32_t bestIndex = UINT32_MAX;
+    uint32_t bestScore = 0;
+    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryTypeCount; ++i) {
+        const VkMemoryPropertyFlags flags = physicalDeviceMemProps.memoryTypes[i].propertyFlags;
+        if (!(memoryTypeBits & (1u << i)) || !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+            continue;
+        }
+
+        const bool cached = (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+        uint32_t score = 1;
+        score += (access == HostAccess::Readback) == cached ? 4 : 0;
+        score += (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? 2 : 0;
+        score += access == HostAccess::Upload && (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? 1 : 0;
+        if (score > bestScore) {
+            bestIndex = i;
+            bestScore = score;
+        }
+    }
+
+    if (bestIndex == UINT32_MAX) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to find suitable memory type");
+    }
+    return bestIndex;
+}
+
+std::vector<MemoryHeapBudget> ComputeContext::getMemoryBudget() const {
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    return queryMemoryBudget();
+}
+
+std::vector<MemoryHeapBudget> ComputeContext::queryMemoryBudget() const {
+    std::vector<MemoryHeapBudget> heaps(physicalDeviceMemProps.memoryHeapCount);
+    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryHeapCount; ++i) {
+        heaps[i].size = physicalDeviceMemProps.memoryHeaps[i].size;
+        heaps[i].budget = heaps[i].size;
+        heaps[i].usage = heapAllocatedBytes[i];
+        heaps[i].deviceLocal = (physicalDeviceMemProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+    if (!memoryBudgetSupported) {
+        return heaps;
+    }
+
+    // Budgets change with the load on the whole system, so they are queried every time
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {};
+    memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    memoryProperties2.pNext = &budgetProperties;
+    vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties2);
+
+    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryHeapCount; ++i) {
+        heaps[i].budget = budgetProperties.heapBudget[i];
+        heaps[i].usage = budgetProperties.heapUsage[i];
+    }
+    return heaps;
+}
+
+VkResult ComputeContext::allocateMemory(const VkMemoryAllocateInfo& memoryAllocateInfo, VkDeviceMemory& memory) const {
+    std::lock_guard<std::mutex> lock(memoryMutex);
+
+    if (memoryRecords.size() >= deviceProperties.limits.maxMemoryAllocationCount) {
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+    const uint32_t heapIndex = physicalDeviceMemProps.memoryTypes[memoryAllocateInfo.memoryTypeIndex].heapIndex;
+    const MemoryHeapBudget heap = queryMemoryBudget()[heapIndex];
+    if (heap.usage + memoryAllocateInfo.allocationSize > heap.budget) {
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    const VkResult result = vkAllocateMemory(vulkanDevice, &memoryAllocateInfo, nullptr, &memory);
+    if (result == VK_SUCCESS) {
+        memoryRecords[memory] = MemoryRecord{ heapIndex, memoryAllocateInfo.allocationSize };
+        heapAllocatedBytes[heapIndex] += memoryAllocateInfo.allocationSize;
+    }
+    return result;
+}
+
+void ComputeContext::freeMemory(VkDeviceMemory memory) const {
+    if (memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    auto record = memoryRecords.find(memory);
+    if (record != memoryRecords.end()) {
+        heapAllocatedBytes[record->second.heapIndex] -= record->second.size;
+        memoryRecords.erase(record);
+    }
+    vkFreeMemory(vulkanDevice, memory, nullptr);
+}
+
+uint32_t ComputeContext::getMemoryAllocationCount() const {
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    return static_cast<uint32_t>(memoryRecords.size());
+}
+
+void ComputeContext::printMemoryHeaps() const {
+    const std::vector<MemoryHeapBudget> heaps = getMemoryBudget();
+    for (uint32_t i = 0; i < heaps.size(); ++i) {
+        std::cout << "Memory heap " << i << ": " << heaps[i].size / (1024 * 1024) << " MB" <<
+            (heaps[i].deviceLocal ? " device-local" : "");
+        if (memoryBudgetSupported) {
+            std::cout << ", budget " << heaps[i].budget / (1024 * 1024) << " MB, " << heaps[i].usage / (1024 * 1024) << " MB in use";
+        }
+        std::cout << std::endl;
+    }
+
+    const uint32_t uploadType = findHostMemoryType(~0u, HostAccess::Upload);
+    const uint32_t readbackType = findHostMemoryType(~0u, HostAccess::Readback);
+    auto describeType = [this](uint32_t index) {
+        const VkMemoryPropertyFlags flags = physicalDeviceMemProps.memoryTypes[index].propertyFlags;
+        return std::to_string(index) + " (heap " + std::to_string(physicalDeviceMemProps.memoryTypes[index].heapIndex) +
+            ((flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? ", cached" : ", uncached") +
+            ((flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? ", coherent)" : ", non-coherent)");
+    };
+    std::cout << "Upload memory type: " << describeType(uploadType) << std::endl;
+    std::cout << "Readback memory type: " << describeType(readbackType) << std::endl;
+}
+
+VkBuffer ComputeContext::createBufferHandle(VkDeviceSize size, VkBufferUsageFlags usage, bool shareWithTransferQueue) const {
+    const uint32_t queueFamilyIndices[] = { computeQueueIndex, transferQueueIndex };
+    const bool concurrent = shareWithTransferQueue && hasTransferQueue();
+
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.pNext = nullptr;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = usage;
+    bufferCreateInfo.sharingMode = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    bufferCreateInfo.queueFamilyIndexCount = concurrent ? 2 : 1;
+    bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+
+    VkBuffer buffer;
+    if (vkCreateBuffer(vulkanDevice, &bufferCreateInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create buffer");
+    }
+    return buffer;
+}
+
+VkSemaphore ComputeContext::createTimelineSemaphore(uint64_t initialValue) const {
+    if (!timelineSemaphoreSupported) {
+        throw std::runtime_error("RUNTIME ERROR: Timeline semaphores are not supported");
+    }
+
+    VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = {};
+    semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphoreTypeCreateInfo.initialValue = initialValue;
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    if (vkCreateSemaphore(vulkanDevice, &semaphoreCreateInfo, nullptr, &semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create timeline semaphore");
+    }
+    return semaphore;
+}
+
+bool ComputeContext::waitTimelineSemaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeoutNanoseconds) const {
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &semaphore;
+    waitInfo.pValues = &value;
+
+    VkResult result = waitSemaphores(vulkanDevice, &waitInfo, timeoutNanoseconds);
+    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to wait for timeline semaphore");
+    }
+    return result == VK_SUCCESS;
+}
+
+uint64_t ComputeContext::getTimelineSemaphoreValue(VkSemaphore semaphore) const {
+    uint64_t value = 0;
+    if (getSemaphoreCounterValue(vulkanDevice, semaphore, &value) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to read timeline semaphore value");
+    }
+    return value;
+}
+
+VkDeviceMemory ComputeContext::importHostPointer(void* pointer, VkDeviceSize size, uint32_t memoryTypeBits,
+    VkMemoryPropertyFlags& propertyFlags) const {
+    if (!supportsHostPointerImport() || size == 0 ||
+        reinterpret_cast<uintptr_t>(pointer) % minImportedHostPointerAlignment != 0 || size % minImportedHostPointerAlignment != 0) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkMemoryHostPointerPropertiesEXT hostPointerProperties = {};
+    hostPointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if (getMemoryHostPointerProperties(vulkanDevice, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, pointer,
+        &hostPointerProperties) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+
+    // Coherent memory needs no flush or invalidate around the dispatch
+    const uint32_t candidateTypeBits = hostPointerProperties.memoryTypeBits & memoryTypeBits;
+    uint32_t memoryTypeIndex = UINT32_MAX;
+    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryTypeCount; ++i) {
+        if ((candidateTypeBits & (1u << i)) == 0) {
+            continue;
+        }
+        const bool coherent = (physicalDeviceMemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+        if (memoryTypeIndex == UINT32_MAX || coherent) {
+            memoryTypeIndex = i;
+        }
+        if (coherent) {
+            break;
+        }
+    }
+    if (memoryTypeIndex == UINT32_MAX) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = pointer;
+
+    VkMemoryAllocateInfo memoryAllocateInfo = {};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.pNext = &importInfo;
+    memoryAllocateInfo.allocationSize = size;
+    memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (allocateMemory(memoryAllocateInfo, memory) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+    propertyFlags = physicalDeviceMemProps.memoryTypes[memoryTypeIndex].propertyFlags;
+    return memory;
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class MemoryArena;
+class Profiler;
+
+// Where kernel storage buffers live. HostVisible maps the storage buffers
+// directly (best on UMA devices and lavapipe); HostCached does the same but
+// puts the input in cached memory as well as the output; DeviceLocal keeps
+// them in device memory and moves data through host-visible staging buffers.
+enum class MemoryMode {
+    Auto,
+    HostVisible,
+    HostCached,
+    DeviceLocal
+};
+
+// What the host does with a mapped buffer, which decides its memory type.
+// Upload prefers uncached, write-combined memory, which is fast for sequential
+// host writes; Readback prefers cached memory, since uncached host reads are
+// very slow. Both fall back to any host-visible type, coherent or not.
+enum class HostAccess {
+    Upload,
+    Readback
+};
+
+const char* memoryModeName(MemoryMode mode);
+// True for the modes where the shader works on mapped host memory directly
+bool isHostMemoryMode(MemoryMode mode);
+// Property flags a memory type needs for the mode's host-visible buffers
+VkMemoryPropertyFlags hostMemoryPropertyFlags(MemoryMode mode);
+// The access a mode's upload or readback buffer is placed for; HostCached
+// places uploads like readbacks
+HostAccess hostAccessFor(MemoryMode mode, HostAccess access);
+
+struct MemoryHeapBudget {
+    VkDeviceSize size = 0;
+    // Bytes this process can allocate from the heap without risking
+    // out-of-memory, and bytes allocated from it (by every process with
+    // VK_EXT_memory_budget, by this context without it)
+    VkDeviceSize budget = 0;
+    VkDeviceSize usage = 0;
+    bool deviceLocal = false;
+};
+
+struct ComputeContextOptions {
+    // Physical device to use; -1 takes the one named by VULKAN_COMPUTE_DEVICE,
+    // or else the highest scoring one (see ComputeContext::scorePhysicalDevice)
+    int deviceIndex = -1;
+    // Queues to create on the compute family; clamped to what the family offers
+    uint32_t computeQueueCount = 1;
+    // Enable VK_LAYER_KHRONOS_validation when it is installed
+    bool enableValidation = true;
+    // Use a transfer-only queue family for staging copies when the device has one
+    bool enableTransferQueue = true;
+    // Directory the pipeline cache is loaded from at startup and saved to at
+    // shutdown; empty disables the on-disk cache
+    std::string pipelineCacheDirectory = ".";
+    // Receives setup and per-job phase timings when set; must outlive the context
+    Profiler* profiler = nullptr;
+};
+
+// Owns the long-lived Vulkan objects (instance, device, queue and pools) that
+// every kernel dispatch shares. Create one per process and keep it alive for
+// as long as kernels are being run.
+class ComputeContext {
+public:
+    static constexpr uint32_t maxComputeQueues = 8;
+    static constexpr const char* deviceEnvironmentVariable = "VULKAN_COMPUTE_DEVICE";
+
+    explicit ComputeContext(const ComputeContextOptions& options = ComputeContextOptions());
+    ~ComputeContext();
+
+    ComputeContext(const ComputeContext&) = delete;
+    ComputeContext& operator=(const ComputeContext&) = delete;
+
+    VkDevice getDevice() const { return vulkanDevice; }
+    VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
+    const VkPhysicalDeviceProperties& getDeviceProperties() const { return deviceProperties; }
+    const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const { return physicalDeviceMemProps; }
+    uint32_t getComputeQueueIndex() const { return computeQueueIndex; }
+    VkQueue getQueue() const { return queue; }
+    // Queues of the compute family; queue 0 is the one getQueue() returns
+    VkQueue getQueue(uint32_t index) const { return computeQueues[index]; }
+    uint32_t getComputeQueueCount() const { return static_cast<uint32_t>(computeQueues.size()); }
+    // Number of physical devices the instance reported, for callers that
+    // open one context per device
+    uint32_t getPhysicalDeviceCount() const { return physicalDeviceCount; }
+    VkCommandPool getCommandPool() const { return commandPool; }
+    bool hasTransferQueue() const { return transferQueue != VK_NULL_HANDLE; }
+    uint32_t getTransferQueueIndex() const { return transferQueueIndex; }
+    VkQueue getTransferQueue() const { return transferQueue; }
+    VkCommandPool getTransferCommandPool() const { return transferCommandPool; }
+    // Descriptor sets for the kernels' two-buffer layouts, shared by every
+    // kernel, slot and runner on this context. Another pool is added whenever
+    // the existing ones run out, so the number of sets is not capped. Sets
+    // must be freed before the context is destroyed.
+    VkDescriptorSet allocateDescriptorSet(VkDescriptorSetLayout layout);
+    void freeDescriptorSet(VkDescriptorSet set);
+    VkPipelineCache getPipelineCache() const { return pipelineCache; }
+    // True when the pipeline cache was seeded with valid data from disk
+    bool isPipelineCacheWarm() const { return pipelineCacheLoadedBytes > 0; }
+    size_t getPipelineCacheLoadedBytes() const { return pipelineCacheLoadedBytes; }
+    // Shared free-list arena that kernels sub-allocate their buffers from
+    MemoryArena& getMemoryArena() const { return *memoryArena; }
+    Profiler* getProfiler() const { return profiler; }
+    // False when the compute queue family reports no valid timestamp bits
+    bool supportsTimestamps() const { return timestampValidBits > 0; }
+    uint32_t getTimestampValidBits() const { return timestampValidBits; }
+    // Vulkan 1.2 core or VK_KHR_timeline_semaphore, enabled at device creation
+    bool supportsTimelineSemaphores() const { return timelineSemaphoreSupported; }
+    // VK_EXT_external_memory_host, enabled at device creation. Imported
+    // pointers and sizes must be multiples of the alignment.
+    bool supportsHostPointerImport() const { return getMemoryHostPointerProperties != nullptr; }
+    VkDeviceSize getMinImportedHostPointerAlignment() const { return minImportedHostPointerAlignment; }
+    // Basic and arithmetic subgroup operations in compute shaders (Vulkan 1.1)
+    bool supportsSubgroupArithmetic() const { return subgroupArithmeticSupported; }
+    uint32_t getSubgroupSize() const { return subgroupSize; }
+
+    bool isUnifiedMemory() const;
+    MemoryMode resolveMemoryMode(MemoryMode requested, std::string& reason) const;
+    bool isMemoryModeSupported(MemoryMode mode) const;
+
+    uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags propertyFlags) const;
+    // Best host-visible memory type for the access pattern (see HostAccess)
+    uint32_t findHostMemoryType(uint32_t memoryTypeBits, HostAccess access) const;
+
+    // VK_EXT_memory_budget, enabled at device creation. Without it every
+    // heap's budget is its size and its usage is what this context has
+    // allocated through allocateMemory().
+    bool supportsMemoryBudget() const { return memoryBudgetSupported; }
+    std::vector<MemoryHeapBudget> getMemoryBudget() const;
+    // Every vkAllocateMemory on this context (arena blocks of every arena and
+    // host pointer imports) goes through these, so maxMemoryAllocationCount
+    // and the heap budgets are checked against all of them together. Returns
+    // VK_ERROR_TOO_MANY_OBJECTS at the allocation count limit and
+    // VK_ERROR_OUT_OF_DEVICE_MEMORY past the heap budget without calling the
+    // driver; otherwise the driver's result.
+    VkResult allocateMemory(const VkMemoryAllocateInfo& memoryAllocateInfo, VkDeviceMemory& memory) const;
+    void freeMemory(VkDeviceMemory memory) const;
+    uint32_t getMemoryAllocationCount() const;
+    // Creates an unbound buffer. Buffers shared with the transfer queue use
+    // concurrent sharing so no ownership transfers are needed.
+    VkBuffer createBufferHandle(VkDeviceSize size, VkBufferUsageFlags usage, bool shareWithTransferQueue = false) const;
+
+    // Timeline semaphore helpers; only valid when supportsTimelineSemaphores().
+    // waitTimelineSemaphore returns false when the timeout expires first.
+    VkSemaphore createTimelineSemaphore(uint64_t initialValue = 0) const;
+    bool waitTimelineSemaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeoutNanoseconds = UINT64_MAX) const;
+    uint64_t getTimelineSemaphoreValue(VkSemaphore semaphore) const;
+
+    // Wraps existing host memory in a VkDeviceMemory, preferring a coherent
+    // memory type that is also in memoryTypeBits. Returns VK_NULL_HANDLE when
+    // the driver cannot import this pointer (for example some file-backed
+    // mappings) or the import would exceed a limit, so callers can fall back
+    // to copying. Release the memory with freeMemory().
+    VkDeviceMemory importHostPointer(void* pointer, VkDeviceSize size, uint32_t memoryTypeBits,
+        VkMemoryPropertyFlags& propertyFlags) const;
+
+    // Ranks devices by type (discrete > integrated > virtual > cpu), then by
+    // compute queue count and device-local heap size
+    static uint64_t scorePhysicalDevice(VkPhysicalDevice device);
+
+private:
+    void createInstance(const ComputeContextOptions& options);
+    bool isDeviceExtensionAvailable(const char* extensionName) const;
+    void selectPhysicalDevice(const ComputeContextOptions& options);
+    void createDevice(const ComputeContextOptions& options);
+    void printMemoryHeaps() const;
+    void createPools();
+    VkDescriptorPool addDescriptorPool();
+    // getMemoryBudget() for callers that already hold memoryMutex
+    std::vector<MemoryHeapBudget> queryMemoryBudget() const;
+    void createPipelineCache(const ComputeContextOptions& options);
+    void savePipelineCache();
+    // Releases every handle created so far; shared by the destructor and a
+    // constructor that throws part way
+    void destroy();
+
+    VkInstance instance = VK_NULL_HANDLE;
+    uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+    uint32_t physicalDeviceCount = 0;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties deviceProperties = {};
+    VkPhysicalDeviceMemoryProperties physicalDeviceMemProps = {};
+    uint32_t computeQueueIndex = 0;
+    uint32_t timestampValidBits = 0;
+    bool timelineSemaphoreSupported = false;
+    PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+    PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties = nullptr;
+    bool memoryBudgetSupported = false;
+    bool subgroupArithmeticSupported = false;
+    uint32_t subgroupSize = 1;
+    VkDeviceSize minImportedHostPointerAlignment = 0;
+    VkDevice vulkanDevice = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    std::vector<VkQueue> computeQueues;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    uint32_t transferQueueIndex = 0;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    // Guards the descriptor pools, which are used by every set owner
+    mutable std::mutex descriptorPoolMutex;
+    std::vector<VkDescriptorPool> descriptorPools;
+    std::unordered_map<VkDescriptorSet, VkDescriptorPool> descriptorSetPools;
+    // Guards the memory accounting, which every arena and import reports to
+    mutable std::mutex memoryMutex;
+    mutable VkDeviceSize heapAllocatedBytes[VK_MAX_MEMORY_HEAPS] = {};
+    struct MemoryRecord {
+        uint32_t heapIndex;
+        VkDeviceSize size;
+    };
+    mutable std::unordered_map<VkDeviceMemory, MemoryRecord> memoryRecords;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    std::string pipelineCachePath;
+    size_t pipelineCacheLoadedBytes = 0;
+    std::unique_ptr<MemoryArena> memoryArena;
+    Profiler* profiler = nullptr;
+};
@@ -0,0 +1,482 @@
+#include "compute_graph.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+namespace {
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+ComputeGraph::ComputeGraph(ComputeContext& context, uint32_t requestedWorkgroupSize)
+    : context(context) {
+    const uint32_t maxSize = ComputeKernel::maxWorkgroupSize(context.getDeviceProperties().limits);
+    workgroupSize = std::min(requestedWorkgroupSize == 0 ? ComputeKernel::defaultWorkgroupSize : requestedWorkgroupSize, maxSize);
+}
+
+ComputeGraph::~ComputeGraph() {
+    VkDevice vulkanDevice = context.getDevice();
+    vkDeviceWaitIdle(vulkanDevice);
+
+    MemoryArena& arena = context.getMemoryArena();
+    for (auto& buffer : buffers) {
+        if (buffer.buffer == VK_NULL_HANDLE) {
+            continue;
+        }
+        if (buffer.kind == GraphBufferKind::Transient) {
+            vkDestroyBuffer(vulkanDevice, buffer.buffer, nullptr);
+        }
+        else {
+            arena.destroyBuffer(buffer.buffer, buffer.allocation);
+        }
+    }
+    if (transientAllocation.memory != VK_NULL_HANDLE) {
+        arena.free(transientAllocation);
+    }
+
+    if (fence != VK_NULL_HANDLE) {
+        vkDestroyFence(vulkanDevice, fence, nullptr);
+    }
+    if (commandBuffer != VK_NULL_HANDLE) {
+        vkFreeCommandBuffers(vulkanDevice, context.getCommandPool(), 1, &commandBuffer);
+    }
+    if (descriptorPool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(vulkanDevice, descriptorPool, nullptr);
+    }
+    for (auto& pass : passes) {
+        vkDestroyPipeline(vulkanDevice, pass.pipeline, nullptr);
+        vkDestroyPipelineLayout(vulkanDevice, pass.pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(vulkanDevice, pass.descriptorSetLayout, nullptr);
+    }
+    for (auto& shaderModule : shaderModules) {
+        vkDestroyShaderModule(vulkanDevice, shaderModule.second, nullptr);
+    }
+}
+
+GraphBufferId ComputeGraph::addBuffer(const std::string& name, GraphBufferKind kind, uint32_t elements) {
+    if (compiled) {
+        throw std::runtime_error("RUNTIME ERROR: Buffers must be added before the graph is compiled");
+    }
+    if (elements == 0) {
+        throw std::runtime_error("RUNTIME ERROR: Graph buffer " + name + " is empty");
+    }
+
+    Buffer buffer;
+    buffer.name = name;
+    buffer.kind = kind;
+    buffer.elements = elements;
+    buffers.push_back(buffer);
+    return static_cast<GraphBufferId>(buffers.size() - 1);
+}
+
+void ComputeGraph::addPass(const std::string& name, const std::string& shaderPath, const std::vector<GraphBinding>& bindings,
+    const KernelParameters& parameters) {
+    if (compiled) {
+        throw std::runtime_error("RUNTIME ERROR: Passes must be added before the graph is compiled");
+    }
+
+    const uint32_t passIndex = static_cast<uint32_t>(passes.size());
+    for (const auto& binding : bindings) {
+        if (binding.buffer >= buffers.size()) {
+            throw std::runtime_error("RUNTIME ERROR: Pass " + name + " binds an unknown buffer");
+        }
+        Buffer& buffer = buffers[binding.buffer];
+        if (static_cast<uint64_t>(parameters.offset) + parameters.count > buffer.elements) {
+            throw std::runtime_error("RUNTIME ERROR: Pass " + name + " reaches past the end of " + buffer.name);
+        }
+        if (binding.write && buffer.kind == GraphBufferKind::Input) {
+            throw std::runtime_error("RUNTIME ERROR: Pass " + name + " writes the input buffer " + buffer.name);
+        }
+        buffer.firstPass = std::min(buffer.firstPass, passIndex);
+        buffer.lastPass = std::max(buffer.lastPass, passIndex);
+    }
+
+    Pass pass;
+    pass.name = name;
+    pass.shaderPath = shaderPath;
+    pass.bindings = bindings;
+    pass.parameters = parameters;
+    passes.push_back(pass);
+}
+
+void ComputeGraph::compile() {
+    if (compiled) {
+        return;
+    }
+
+    ScopedPhase phase(context.getProfiler(), "graph_compile");
+    createPipelines();
+    allocateBuffers();
+    createDescriptorSets();
+
+    VkCommandBufferAllocateInfo cmdBufferAllocateInfo = {};
+    cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufferAllocateInfo.commandPool = context.getCommandPool();
+    cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufferAllocateInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(context.getDevice(), &cmdBufferAllocateInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to allocate command buffers");
+    }
+
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if (vkCreateFence(context.getDevice(), &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create fence");
+    }
+
+    recordCommandBuffer();
+    compiled = true;
+}
+
+VkShaderModule ComputeGraph::getShaderModule(const std::string& shaderPath) {
+    // Passes running the same shader share one module
+    auto found = shaderModules.find(shaderPath);
+    if (found != shaderModules.end()) {
+        return found->second;
+    }
+
+    auto compShader = readFile(shaderPath);
+
+    VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleCreateInfo.codeSize = compShader.size();
+    shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(compShader.data());
+
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(context.getDevice(), &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create shader module");
+    }
+    shaderModules[shaderPath] = shaderModule;
+    return shaderModule;
+}
+
+void ComputeGraph::createPipelines() {
+    VkDevice vulkanDevice = context.getDevice();
+
+    const uint32_t workgroupSizeData[3] = { workgroupSize, 1, 1 };
+
+    VkSpecializationMapEntry specializationMapEntries[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        specializationMapEntries[i].constantID = i;
+        specializationMapEntries[i].offset = i * sizeof(uint32_t);
+        specializationMapEntries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = 3;
+    specializationInfo.pMapEntries = specializationMapEntries;
+    specializationInfo.dataSize = sizeof(workgroupSizeData);
+    specializationInfo.pData = workgroupSizeData;
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(KernelParameters);
+
+    for (auto& pass : passes) {
+        // Create descriptor set layout
+        std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindings;
+        for (const auto& graphBinding : pass.bindings) {
+            VkDescriptorSetLayoutBinding binding = {};
+            binding.binding = graphBinding.binding;
+            binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            binding.descriptorCount = 1;
+            binding.stageFlags |= VK_SHADER_STAGE_COMPUTE_BIT;
+            descriptorSetLayoutBindings.push_back(binding);
+        }
+
+        VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+        descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        descriptorSetLayoutCreateInfo.bindingCount = static_cast<uint32_t>(descriptorSetLayoutBindings.size());
+        descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings.data();
+
+        if (vkCreateDescriptorSetLayout(vulkanDevice, &descriptorSetLayoutCreateInfo, nullptr, &pass.descriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor set layout");
+        }
+
+        // Create compute pipeline
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.pSetLayouts = &pass.descriptorSetLayout;
+        pipelineLayoutCreateInfo.setLayoutCount = 1;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(vulkanDevice, &pipelineLayoutCreateInfo, nullptr, &pass.pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create pipeline layout");
+        }
+
+        VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo = {};
+        pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineShaderStageCreateInfo.pName = "main";
+        pipelineShaderStageCreateInfo.module = getShaderModule(pass.shaderPath);
+        pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+        computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        computePipelineCreateInfo.layout = pass.pipelineLayout;
+        computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo;
+
+        if (vkCreateComputePipelines(vulkanDevice, context.getPipelineCache(), 1, &computePipelineCreateInfo, nullptr, &pass.pipeline) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create compute pipeline");
+        }
+    }
+}
+
+void ComputeGraph::allocateBuffers() {
+    VkDevice vulkanDevice = context.getDevice();
+    MemoryArena& arena = context.getMemoryArena();
+
+    std::vector<Buffer*> transients;
+    for (auto& buffer : buffers) {
+        const VkDeviceSize bufferSize = buffer.elements * sizeof(uint32_t);
+        if (buffer.kind != GraphBufferKind::Transient) {
+            const HostAccess access = buffer.kind == GraphBufferKind::Input ? HostAccess::Upload : HostAccess::Readback;
+            arena.createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, access, buffer.buffer, buffer.allocation);
+            continue;
+        }
+
+        buffer.buffer = context.createBufferHandle(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        vkGetBufferMemoryRequirements(vulkanDevice, buffer.buffer, &buffer.memoryReq);
+        unaliasedTransientBytes += alignUp(buffer.memoryReq.size, buffer.memoryReq.alignment);
+        transients.push_back(&buffer);
+    }
+
+    if (transients.empty()) {
+        return;
+    }
+
+    placeTransients(transients);
+
+    // One allocation backs every transient; it has to satisfy all of them at once
+    VkMemoryRequirements combinedReq = {};
+    combinedReq.size = transientBytes;
+    combinedReq.alignment = 1;
+    combinedReq.memoryTypeBits = ~0u;
+    for (const Buffer* buffer : transients) {
+        combinedReq.alignment = std::max(combinedReq.alignment, buffer->memoryReq.alignment);
+        combinedReq.memoryTypeBits &= buffer->memoryReq.memoryTypeBits;
+    }
+    if (combinedReq.memoryTypeBits == 0) {
+        throw std::runtime_error("RUNTIME ERROR: Transient buffers have no memory type in common");
+    }
+
+    transientAllocation = arena.allocate(combinedReq, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    for (const Buffer* buffer : transients) {
+        if (vkBindBufferMemory(vulkanDevice, buffer->buffer, transientAllocation.memory,
+            transientAllocation.offset + buffer->aliasOffset) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to bind buffer memory");
+        }
+    }
+}
+
+void ComputeGraph::placeTransients(std::vector<Buffer*>& transients) {
+    auto lifetimesOverlap = [](const Buffer& a, const Buffer& b) {
+        // A transient no pass uses is never live
+        if (a.firstPass == UINT32_MAX || b.firstPass == UINT32_MAX) {
+            return false;
+        }
+        return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass;
+    };
+
+    // Largest first, each at the lowest offset that no live buffer occupies
+    std::stable_sort(transients.begin(), transients.end(), [](const Buffer* a, const Buffer* b) {
+        return a->memoryReq.size > b->memoryReq.size;
+    });
+
+    std::vector<const Buffer*> placed;
+    for (Buffer* buffer : transients) {
+        std::vector<const Buffer*> live;
+        for (const Buffer* other : placed) {
+            if (lifetimesOverlap(*buffer, *other)) {
+                live.push_back(other);
+            }
+        }
+
+        // Candidates are the start of the allocation and the end of every live buffer
+        std::vector<VkDeviceSize> candidates = { 0 };
+        for (const Buffer* other : live) {
+            candidates.push_back(alignUp(other->aliasOffset + other->memoryReq.size, buffer->memoryReq.alignment));
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (VkDeviceSize candidate : candidates) {
+            const bool fits = std::none_of(live.begin(), live.end(), [&](const Buffer* other) {
+                return candidate < other->aliasOffset + other->memoryReq.size &&
+                    other->aliasOffset < candidate + buffer->memoryReq.size;
+            });
+            if (fits) {
+                buffer->aliasOffset = candidate;
+                break;
+            }
+        }
+
+        transientBytes = std::max(transientBytes, buffer->aliasOffset + buffer->memoryReq.size);
+        placed.push_back(buffer);
+    }
+}
+
+void ComputeGraph::createDescriptorSets() {
+    VkDevice vulkanDevice = context.getDevice();
+
+    uint32_t bindingCount = 0;
+    for (const auto& pass : passes) {
+        bindingCount += static_cast<uint32_t>(pass.bindings.size());
+    }
+
+    VkDescriptorPoolSize descriptorPoolSize = {};
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSize.descriptorCount = std::max(bindingCount, 1u);
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = std::max(static_cast<uint32_t>(passes.size()), 1u);
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+
+    if (vkCreateDescriptorPool(vulkanDevice, &descriptorPoolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor pool");
+    }
+
+    for (auto& pass : passes) {
+        VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+        descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        descriptorSetAllocateInfo.descriptorPool = descriptorPool;
+        descriptorSetAllocateInfo.descriptorSetCount = 1;
+        descriptorSetAllocateInfo.pSetLayouts = &pass.descriptorSetLayout;
+
+        if (vkAllocateDescriptorSets(vulkanDevice, &descriptorSetAllocateInfo, &pass.descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to allocate descriptor sets");
+        }
+
+        std::vector<VkDescriptorBufferInfo> bufferInfos(pass.bindings.size());
+        std::vector<VkWriteDescriptorSet> writeDescriptorSetVec(pass.bindings.size());
+        for (size_t i = 0; i < pass.bindings.size(); i++) {
+            const Buffer& buffer = buffers[pass.bindings[i].buffer];
+            bufferInfos[i].buffer = buffer.buffer;
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = buffer.elements * sizeof(uint32_t);
+
+            VkWriteDescriptorSet writeDescriptorSet = {};
+            writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeDescriptorSet.dstBinding = pass.bindings[i].binding;
+            writeDescriptorSet.dstArrayElement = 0;
+            writeDescriptorSet.descriptorCount = 1;
+            writeDescriptorSet.dstSet = pass.descriptorSet;
+            writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writeDescriptorSet.pBufferInfo = &bufferInfos[i];
+            writeDescriptorSetVec[i] = writeDescriptorSet;
+        }
+
+        vkUpdateDescriptorSets(vulkanDevice, static_cast<uint32_t>(writeDescriptorSetVec.size()),
+            writeDescriptorSetVec.data(), 0, nullptr);
+    }
+}
+
+bool ComputeGraph::memoryOverlaps(const Buffer& a, const Buffer& b) const {
+    if (&a == &b) {
+        return true;
+    }
+    if (a.kind != GraphBufferKind::Transient || b.kind != GraphBufferKind::Transient) {
+        return false;
+    }
+    return a.aliasOffset < b.aliasOffset + b.memoryReq.size && b.aliasOffset < a.aliasOffset + a.memoryReq.size;
+}
+
+void ComputeGraph::recordCommandBuffer() {
+    const VkPhysicalDeviceLimits& limits = context.getDeviceProperties().limits;
+
+    // Accesses since the last barrier; a pass only has to wait when it
+    // touches memory one of them wrote, or writes memory one of them read
+    std::vector<const Buffer*> pendingWrites;
+    std::vector<const Buffer*> pendingReads;
+
+    auto overlapsAny = [this](const Buffer& buffer, const std::vector<const Buffer*>& accesses) {
+        return std::any_of(accesses.begin(), accesses.end(), [&](const Buffer* other) {
+            return memoryOverlaps(buffer, *other);
+        });
+    };
+
+    barrierCount = 0;
+    beginReusableCommandBuffer(commandBuffer);
+    for (const auto& pass : passes) {
+        bool hazard = false;
+        for (const auto& binding : pass.bindings) {
+            const Buffer& buffer = buffers[binding.buffer];
+            hazard = hazard || overlapsAny(buffer, pendingWrites) || (binding.write && overlapsAny(buffer, pendingReads));
+        }
+
+        if (hazard) {
+            // Write-after-read only needs the execution dependency
+            const VkAccessFlags srcAccess = pendingWrites.empty() ? 0 : VK_ACCESS_SHADER_WRITE_BIT;
+            memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, srcAccess,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+            ++barrierCount;
+            pendingWrites.clear();
+            pendingReads.clear();
+        }
+
+        for (const auto& binding : pass.bindings) {
+            const Buffer* buffer = &buffers[binding.buffer];
+            (binding.write ? pendingWrites : pendingReads).push_back(buffer);
+        }
+
+        uint32_t groupCountX = 0;
+        uint32_t groupCountY = 0;
+        dispatchGroupCounts(limits, pass.parameters.count, workgroupSize, groupCountX, groupCountY);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipelineLayout, 0, 1, &pass.descriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pass.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(KernelParameters), &pass.parameters);
+        vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+    }
+    // Only the outputs are read back, and they are host-visible
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    vkEndCommandBuffer(commandBuffer);
+}
+
+void ComputeGraph::run() {
+    compile();
+
+    VkDevice vulkanDevice = context.getDevice();
+    MemoryArena& arena = context.getMemoryArena();
+    for (const auto& buffer : buffers) {
+        if (buffer.kind == GraphBufferKind::Input) {
+            arena.flush(buffer.allocation, 0, buffer.elements * sizeof(uint32_t));
+        }
+    }
+    vkResetFences(vulkanDevice, 1, &fence);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    if (vkQueueSubmit(context.getQueue(), 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed submit command buffer to queue");
+    }
+    vkWaitForFences(vulkanDevice, 1, &fence, true, UINT64_MAX);
+
+    for (const auto& buffer : buffers) {
+        if (buffer.kind == GraphBufferKind::Output) {
+            arena.invalidate(buffer.allocation, 0, buffer.elements * sizeof(uint32_t));
+        }
+    }
+}
+
+void* ComputeGraph::getMappedData(GraphBufferId buffer) const {
+    if (!compiled || buffer >= buffers.size() || buffers[buffer].kind == GraphBufferKind::Transient) {
+        throw std::runtime_error("RUNTIME ERROR: Graph buffer has no host mapping");
+    }
+    return buffers[buffer].allocation.mapped;
+}
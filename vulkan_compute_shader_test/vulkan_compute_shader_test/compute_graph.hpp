@@ -0,0 +1,121 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "compute_kernel.hpp"
+#include "memory_arena.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+using GraphBufferId = uint32_t;
+
+// Inputs and outputs live in host-visible memory so the caller can fill and
+// read them through getMappedData(). Transients only ever exist on the device
+// and may share memory with other transients whose lifetimes do not overlap.
+enum class GraphBufferKind {
+    Input,
+    Output,
+    Transient
+};
+
+// One storage buffer binding of a pass. write marks buffers the shader
+// writes; everything else is treated as read-only.
+struct GraphBinding {
+    uint32_t binding = 0;
+    GraphBufferId buffer = 0;
+    bool write = false;
+};
+
+// Several compute passes recorded into one command buffer. Passes are
+// declared in execution order with the buffers they read and write; compile()
+// then creates the pipelines, places the buffers and records everything once.
+//
+// Barriers come from the declared accesses: a pass that reads or overwrites
+// what an earlier pass wrote, or overwrites what it read, waits behind a
+// single compute-to-compute memory barrier, while independent passes run
+// without one. Transient memory is assigned greedily by size; two transients
+// only share bytes when the passes between their first and last use do not
+// overlap, and a pass that touches reused bytes waits for the previous owner.
+//
+// Every pass uses the same push constants as compute_shader.comp
+// (KernelParameters) and local_size_x through specialization constant 0.
+class ComputeGraph {
+public:
+    explicit ComputeGraph(ComputeContext& context, uint32_t workgroupSize = ComputeKernel::defaultWorkgroupSize);
+    ~ComputeGraph();
+
+    ComputeGraph(const ComputeGraph&) = delete;
+    ComputeGraph& operator=(const ComputeGraph&) = delete;
+
+    // Sizes are in uint32 elements
+    GraphBufferId addBuffer(const std::string& name, GraphBufferKind kind, uint32_t elements);
+    // Dispatches parameters.count invocations of shaderPath with the given bindings
+    void addPass(const std::string& name, const std::string& shaderPath, const std::vector<GraphBinding>& bindings,
+        const KernelParameters& parameters);
+
+    void compile();
+    // Submits the recorded command buffer and waits for it
+    void run();
+
+    // Mapped memory of an input or output buffer; valid after compile().
+    // run() flushes the inputs before the submit and invalidates the outputs
+    // after it, so plain reads and writes are enough on any memory type.
+    void* getMappedData(GraphBufferId buffer) const;
+
+    uint32_t getBarrierCount() const { return barrierCount; }
+    // Transient bytes with and without aliasing
+    VkDeviceSize getTransientBytes() const { return transientBytes; }
+    VkDeviceSize getUnaliasedTransientBytes() const { return unaliasedTransientBytes; }
+
+private:
+    struct Buffer {
+        std::string name;
+        GraphBufferKind kind;
+        uint32_t elements;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        ArenaAllocation allocation;
+        VkMemoryRequirements memoryReq = {};
+        // Transients only: offset inside the shared transient allocation and
+        // the first and last pass that use the buffer
+        VkDeviceSize aliasOffset = 0;
+        uint32_t firstPass = UINT32_MAX;
+        uint32_t lastPass = 0;
+    };
+
+    struct Pass {
+        std::string name;
+        std::string shaderPath;
+        std::vector<GraphBinding> bindings;
+        KernelParameters parameters;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    };
+
+    VkShaderModule getShaderModule(const std::string& shaderPath);
+    void createPipelines();
+    void allocateBuffers();
+    void placeTransients(std::vector<Buffer*>& transients);
+    void createDescriptorSets();
+    void recordCommandBuffer();
+    // True when the two buffers may share bytes (the same buffer, or aliased transients)
+    bool memoryOverlaps(const Buffer& a, const Buffer& b) const;
+
+    ComputeContext& context;
+    uint32_t workgroupSize;
+    std::vector<Buffer> buffers;
+    std::vector<Pass> passes;
+    std::map<std::string, VkShaderModule> shaderModules;
+    bool compiled = false;
+
+    ArenaAllocation transientAllocation;
+    VkDeviceSize transientBytes = 0;
+    VkDeviceSize unaliasedTransientBytes = 0;
+    uint32_t barrierCount = 0;
+
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+};
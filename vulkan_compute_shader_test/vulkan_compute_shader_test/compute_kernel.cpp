@@ -0,0 +1,376 @@
+#include "compute_kernel.hpp"
+#include "job_slot.hpp"
+#include "kernel_registry.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+
+uint32_t ComputeKernel::maxWorkgroupSize(const VkPhysicalDeviceLimits& limits) {
+    return std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+}
+
+ComputeKernel::ComputeKernel(ComputeContext& context, const std::string& shaderPath, MemoryMode requestedMemoryMode,
+    uint32_t requestedWorkgroupSize)
+    : context(context) {
+    const uint32_t maxSize = maxWorkgroupSize(context.getDeviceProperties().limits);
+    workgroupSize = std::min(requestedWorkgroupSize == 0 ? defaultWorkgroupSize : requestedWorkgroupSize, maxSize);
+
+    resolveMemoryMode(requestedMemoryMode);
+    try {
+        createPipeline(shaderPath);
+        slot = std::make_unique<JobSlot>(context, *this, 0, true);
+    }
+    catch (...) {
+        destroy();
+        throw;
+    }
+}
+
+ComputeKernel::ComputeKernel(ComputeContext& context, KernelRegistry& registry, const std::string& name,
+    MemoryMode requestedMemoryMode, uint32_t requestedWorkgroupSize)
+    : context(context), ownsLayouts(false) {
+    const uint32_t maxSize = maxWorkgroupSize(context.getDeviceProperties().limits);
+    workgroupSize = requestedWorkgroupSize == 0 ? registry.getWorkgroupSize() : std::min(requestedWorkgroupSize, maxSize);
+
+    resolveMemoryMode(requestedMemoryMode);
+
+    // Layouts, module and (for the registry's workgroup size) the pipeline are
+    // borrowed, so only the kernel's own handles are released on a failure
+    try {
+        descriptorSetLayout = registry.getDescriptorSetLayout();
+        pipelineLayout = registry.getPipelineLayout();
+        {
+            ScopedPhase phase(context.getProfiler(), "shader_module");
+            compShaderModule = registry.getShaderModule(name);
+        }
+
+        if (workgroupSize == registry.getWorkgroupSize()) {
+            // The registry creates the pipeline on first use and keeps it
+            auto pipelineStart = std::chrono::steady_clock::now();
+            computePipeline = registry.getPipeline(name);
+            auto pipelineEnd = std::chrono::steady_clock::now();
+            ownsPipeline = false;
+            ++pipelineGeneration;
+            pipelineCreationMilliseconds = std::chrono::duration<double, std::milli>(pipelineEnd - pipelineStart).count();
+            if (context.getProfiler() != nullptr) {
+                context.getProfiler()->record("pipeline_creation", pipelineCreationMilliseconds);
+            }
+        }
+        else {
+            createComputePipeline();
+        }
+        slot = std::make_unique<JobSlot>(context, *this, 0, true);
+    }
+    catch (...) {
+        destroy();
+        throw;
+    }
+}
+
+void ComputeKernel::resolveMemoryMode(MemoryMode requestedMemoryMode) {
+    std::string reason;
+    memoryMode = context.resolveMemoryMode(requestedMemoryMode, reason);
+    useTransferQueue = memoryMode == MemoryMode::DeviceLocal && context.hasTransferQueue();
+
+    std::cout << "Memory path: " << memoryModeName(memoryMode) << " (" << reason << ")" << std::endl;
+    if (memoryMode == MemoryMode::DeviceLocal) {
+        std::cout << "    Staging copies on: " << (useTransferQueue ? "transfer queue" : "compute queue") << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+ComputeKernel::~ComputeKernel() {
+    vkDeviceWaitIdle(context.getDevice());
+    destroy();
+}
+
+void ComputeKernel::destroy() {
+    VkDevice vulkanDevice = context.getDevice();
+
+    slot.reset();
+    if (ownsPipeline) {
+        vkDestroyPipeline(vulkanDevice, computePipeline, nullptr);
+    }
+    if (ownsLayouts) {
+        vkDestroyPipelineLayout(vulkanDevice, pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(vulkanDevice, descriptorSetLayout, nullptr);
+        vkDestroyShaderModule(vulkanDevice, compShaderModule, nullptr);
+    }
+}
+
+void ComputeKernel::createPipeline(const std::string& shaderPath) {
+    VkDevice vulkanDevice = context.getDevice();
+
+    // Create shader module
+    {
+        ScopedPhase phase(context.getProfiler(), "shader_module");
+        auto compShader = readFile(shaderPath);
+
+        VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+        shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderModuleCreateInfo.codeSize = compShader.size();
+        shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(compShader.data());
+
+        if (vkCreateShaderModule(vulkanDevice, &shaderModuleCreateInfo, nullptr, &compShaderModule) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create shader module");
+        }
+    }
+
+    // Create descriptor set layout
+    VkDescriptorSetLayoutBinding descriptorSetLayoutBindings[2];
+
+    for (uint32_t i = 0; i < 2; i++) {
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = i;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags |= VK_SHADER_STAGE_COMPUTE_BIT;
+        descriptorSetLayoutBindings[i] = binding;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = 2;
+    descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings;
+
+    if (vkCreateDescriptorSetLayout(vulkanDevice, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor set layout");
+    }
+
+    // Per-dispatch scalars go through push constants
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(KernelParameters);
+
+    // Create compute pipeline
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(vulkanDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create pipeline layout");
+    }
+
+    createComputePipeline();
+}
+
+void ComputeKernel::createComputePipeline() {
+    VkDevice vulkanDevice = context.getDevice();
+
+    // Workgroup size is baked into the pipeline through specialization constants 0-2
+    const uint32_t workgroupSizeData[3] = { workgroupSize, 1, 1 };
+
+    VkSpecializationMapEntry specializationMapEntries[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        specializationMapEntries[i].constantID = i;
+        specializationMapEntries[i].offset = i * sizeof(uint32_t);
+        specializationMapEntries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = 3;
+    specializationInfo.pMapEntries = specializationMapEntries;
+    specializationInfo.dataSize = sizeof(workgroupSizeData);
+    specializationInfo.pData = workgroupSizeData;
+
+    VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo = {};
+    pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineShaderStageCreateInfo.pName = "main";
+    pipelineShaderStageCreateInfo.module = compShaderModule;
+    pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.layout = pipelineLayout;
+    computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo;
+
+    auto pipelineStart = std::chrono::steady_clock::now();
+    if (vkCreateComputePipelines(vulkanDevice, context.getPipelineCache(), 1, &computePipelineCreateInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create compute pipeline");
+    }
+    auto pipelineEnd = std::chrono::steady_clock::now();
+    ++pipelineGeneration;
+    pipelineCreationMilliseconds = std::chrono::duration<double, std::milli>(pipelineEnd - pipelineStart).count();
+    if (context.getProfiler() != nullptr) {
+        context.getProfiler()->record("pipeline_creation", pipelineCreationMilliseconds);
+    }
+}
+
+void ComputeKernel::setWorkgroupSize(uint32_t size) {
+    if (size == 0 || size > maxWorkgroupSize(context.getDeviceProperties().limits)) {
+        throw std::runtime_error("RUNTIME ERROR: Workgroup size outside device limits");
+    }
+    if (size == workgroupSize) {
+        return;
+    }
+
+    vkDeviceWaitIdle(context.getDevice());
+    // A borrowed pipeline stays with the registry; the new one is the kernel's
+    if (ownsPipeline) {
+        vkDestroyPipeline(context.getDevice(), computePipeline, nullptr);
+    }
+    computePipeline = VK_NULL_HANDLE;
+    workgroupSize = size;
+    createComputePipeline();
+    ownsPipeline = true;
+    // The new pipeline generation makes every slot re-record its command buffers
+}
+
+void ComputeKernel::writeDescriptorSet(VkDescriptorSet set, VkBuffer input, VkBuffer output, uint32_t elements) const {
+    VkDescriptorBufferInfo inBufferInfo = {};
+    inBufferInfo.buffer = input;
+    inBufferInfo.offset = 0;
+    inBufferInfo.range = elements * sizeof(uint32_t);
+
+    VkDescriptorBufferInfo outBufferInfo = {};
+    outBufferInfo.buffer = output;
+    outBufferInfo.offset = 0;
+    outBufferInfo.range = elements * sizeof(uint32_t);
+
+    VkWriteDescriptorSet writeInBufferDescriptorSet = {};
+    writeInBufferDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeInBufferDescriptorSet.dstBinding = 0;
+    writeInBufferDescriptorSet.dstArrayElement = 0;
+    writeInBufferDescriptorSet.descriptorCount = 1;
+    writeInBufferDescriptorSet.dstSet = set;
+    writeInBufferDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeInBufferDescriptorSet.pBufferInfo = &inBufferInfo;
+
+    VkWriteDescriptorSet writeOutBufferDescriptorSet = {};
+    writeOutBufferDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeOutBufferDescriptorSet.dstBinding = 1;
+    writeOutBufferDescriptorSet.dstArrayElement = 0;
+    writeOutBufferDescriptorSet.descriptorCount = 1;
+    writeOutBufferDescriptorSet.dstSet = set;
+    writeOutBufferDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeOutBufferDescriptorSet.pBufferInfo = &outBufferInfo;
+
+    const std::vector<VkWriteDescriptorSet> writeDescriptorSetVec = { writeInBufferDescriptorSet, writeOutBufferDescriptorSet };
+
+    vkUpdateDescriptorSets(context.getDevice(), 2, writeDescriptorSetVec.data(), 0, nullptr);
+}
+
+void ComputeKernel::run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
+    const uint32_t elements = static_cast<uint32_t>(input.size());
+    const VkDeviceSize bufferSize = elements * sizeof(uint32_t);
+
+    output.resize(elements);
+    if (elements == 0) {
+        return;
+    }
+
+    Profiler* profiler = context.getProfiler();
+
+    // Buffers are only reallocated when the job outgrows them
+    if (elements > slot->getCapacity()) {
+        ScopedPhase phase(profiler, "buffer_allocation");
+        slot->reserve(elements);
+    }
+
+    // Host-visible arena blocks stay mapped, so no vkMapMemory is needed here;
+    // the slot flushes and invalidates the job's range of non-coherent memory
+    {
+        ScopedPhase phase(profiler, "upload_copy");
+        memcpy(slot->getUploadData(), input.data(), bufferSize);
+    }
+
+    {
+        ScopedPhase phase(profiler, "submit");
+        auto submitStart = std::chrono::steady_clock::now();
+        slot->submit(elements);
+        lastSubmitMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - submitStart).count();
+    }
+
+    {
+        ScopedPhase phase(profiler, "fence_wait");
+        slot->wait();
+    }
+    if (slot->readDispatchMilliseconds(lastDispatchMilliseconds) && profiler != nullptr) {
+        profiler->record("dispatch", lastDispatchMilliseconds, PhaseClock::Gpu);
+    }
+
+    // Read back results
+    {
+        ScopedPhase phase(profiler, "readback_copy");
+        memcpy(output.data(), slot->getReadbackData(elements), bufferSize);
+    }
+}
+
+bool ComputeKernel::hasGpuTimestamps() const {
+    return slot->hasTimestamps();
+}
+
+uint32_t ComputeKernel::getRecordCount() const {
+    return slot->getRecordCount();
+}
+
+void ComputeKernel::recordDispatch(VkCommandBuffer cmdBuffer, VkDescriptorSet set, uint32_t elements) const {
+    KernelParameters parameters;
+    parameters.count = elements;
+    parameters.scale = scale;
+    recordDispatch(cmdBuffer, set, parameters);
+}
+
+void ComputeKernel::recordDispatch(VkCommandBuffer cmdBuffer, VkDescriptorSet set, const KernelParameters& parameters) const {
+    uint32_t groupCountX = 0;
+    uint32_t groupCountY = 0;
+    dispatchGroupCounts(context.getDeviceProperties().limits, parameters.count, workgroupSize, groupCountX, groupCountY);
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+    vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(KernelParameters), &parameters);
+    vkCmdDispatch(cmdBuffer, groupCountX, groupCountY, 1);
+}
+
+void dispatchGroupCounts(const VkPhysicalDeviceLimits& limits, uint32_t elements, uint32_t workgroupSize,
+    uint32_t& groupCountX, uint32_t& groupCountY) {
+    // Round up to whole workgroups and spill into y once x hits maxComputeWorkGroupCount
+    const uint32_t groupCount = std::max((elements + workgroupSize - 1) / workgroupSize, 1u);
+    groupCountX = std::min(groupCount, limits.maxComputeWorkGroupCount[0]);
+    groupCountY = (groupCount + groupCountX - 1) / groupCountX;
+    if (groupCountY > limits.maxComputeWorkGroupCount[1]) {
+        throw std::runtime_error("RUNTIME ERROR: Job exceeds maxComputeWorkGroupCount");
+    }
+}
+
+void beginOneTimeCommandBuffer(VkCommandBuffer cmdBuffer) {
+    VkCommandBufferBeginInfo cmdBufferBeginInfo = {};
+    cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdBufferBeginInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(cmdBuffer, &cmdBufferBeginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to begin command buffer");
+    }
+}
+
+void beginReusableCommandBuffer(VkCommandBuffer cmdBuffer) {
+    // No SIMULTANEOUS_USE: a command buffer is only resubmitted once its
+    // previous submission has completed
+    VkCommandBufferBeginInfo cmdBufferBeginInfo = {};
+    cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+    if (vkBeginCommandBuffer(cmdBuffer, &cmdBufferBeginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to begin command buffer");
+    }
+}
+
+void memoryBarrier(VkCommandBuffer cmdBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(cmdBuffer, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
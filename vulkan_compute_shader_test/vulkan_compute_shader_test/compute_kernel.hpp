@@ -0,0 +1,137 @@
+#pragma once
+
+#include "compute_context.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class JobSlot;
+class KernelRegistry;
+
+// Push constants of compute_shader.comp. Values are captured when a command
+// buffer is recorded, so a change costs a re-record but never a descriptor
+// update or a buffer reallocation.
+struct KernelParameters {
+    // Elements to process, starting at offset
+    uint32_t count = 0;
+    uint32_t offset = 0;
+    uint32_t scale = 1;
+
+    bool operator==(const KernelParameters& other) const {
+        return count == other.count && offset == other.offset && scale == other.scale;
+    }
+};
+
+// A compute pipeline built from a single SPIR-V shader with an input storage
+// buffer at binding 0 and an output storage buffer at binding 1. The pipeline
+// is created once, and run() goes through a JobSlot of the kernel's that is
+// reused by every call: its buffers are sub-allocated from the context's
+// memory arena and only grow when a larger job arrives, and its command
+// buffers are recorded once and resubmitted as long as the job size and
+// parameters stay the same.
+//
+// In DeviceLocal mode the storage buffers live in device memory and data is
+// staged through host-visible buffers with vkCmdCopyBuffer. When the context
+// has a transfer queue the copies are submitted there and chained to the
+// dispatch with semaphores.
+//
+// A kernel built from a KernelRegistry uses the registry's module and layouts
+// and, at the registry's workgroup size, its pipeline as well; the registry
+// must outlive the kernel.
+class ComputeKernel {
+public:
+    static constexpr uint32_t defaultWorkgroupSize = 64;
+
+    // workgroupSize 0 uses defaultWorkgroupSize; sizes are clamped to the device limits
+    ComputeKernel(ComputeContext& context, const std::string& shaderPath, MemoryMode memoryMode = MemoryMode::Auto,
+        uint32_t workgroupSize = 0);
+    // workgroupSize 0 uses the registry's size. Any other size specializes a
+    // pipeline of the kernel's own from the registry's module.
+    ComputeKernel(ComputeContext& context, KernelRegistry& registry, const std::string& name,
+        MemoryMode memoryMode = MemoryMode::Auto, uint32_t workgroupSize = 0);
+    ~ComputeKernel();
+
+    ComputeKernel(const ComputeKernel&) = delete;
+    ComputeKernel& operator=(const ComputeKernel&) = delete;
+
+    void run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output);
+
+    MemoryMode getMemoryMode() const { return memoryMode; }
+    bool usesTransferQueue() const { return useTransferQueue; }
+    double getPipelineCreationMilliseconds() const { return pipelineCreationMilliseconds; }
+    // GPU time between the timestamps around the last dispatch; only valid
+    // when hasGpuTimestamps() is true
+    bool hasGpuTimestamps() const;
+    double getLastDispatchMilliseconds() const { return lastDispatchMilliseconds; }
+
+    // Multiplier applied to every result (out = in * in * scale)
+    uint32_t getScale() const { return scale; }
+    void setScale(uint32_t value) { scale = value; }
+
+    // With reuse off every submit records fresh one-time-submit command
+    // buffers, which is how the re-record cost is measured. Applies to every
+    // JobSlot built on this kernel.
+    bool getCommandBufferReuse() const { return reuseCommandBuffers; }
+    void setCommandBufferReuse(bool reuse) { reuseCommandBuffers = reuse; }
+    // Host time of the last run()'s submit phase: recording (when needed) plus vkQueueSubmit
+    double getLastSubmitMicroseconds() const { return lastSubmitMicroseconds; }
+    // Command buffer recordings made by run()
+    uint32_t getRecordCount() const;
+
+    uint32_t getWorkgroupSize() const { return workgroupSize; }
+    // Rebuilds the pipeline with a new local_size_x specialization
+    void setWorkgroupSize(uint32_t size);
+    // Bumped whenever the pipeline is rebuilt; command buffers recorded
+    // against an older generation must be re-recorded
+    uint32_t getPipelineGeneration() const { return pipelineGeneration; }
+    static uint32_t maxWorkgroupSize(const VkPhysicalDeviceLimits& limits);
+
+    // Building blocks for callers that manage their own buffers and
+    // descriptor sets against this kernel's pipeline (see StreamRunner)
+    VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+    void writeDescriptorSet(VkDescriptorSet set, VkBuffer input, VkBuffer output, uint32_t elements) const;
+    // Binds the pipeline and set, pushes the parameters and dispatches
+    // parameters.count invocations. The elements overload uses offset 0 and
+    // the kernel's scale.
+    void recordDispatch(VkCommandBuffer cmdBuffer, VkDescriptorSet set, const KernelParameters& parameters) const;
+    void recordDispatch(VkCommandBuffer cmdBuffer, VkDescriptorSet set, uint32_t elements) const;
+
+private:
+    void resolveMemoryMode(MemoryMode requestedMemoryMode);
+    void createPipeline(const std::string& shaderPath);
+    void createComputePipeline();
+    // Releases the handles the kernel owns; also unwinds a constructor that
+    // throws part way, so every handle may still be null
+    void destroy();
+
+    ComputeContext& context;
+    MemoryMode memoryMode;
+    bool useTransferQueue = false;
+    double pipelineCreationMilliseconds = 0.0;
+    double lastDispatchMilliseconds = 0.0;
+    uint32_t workgroupSize = defaultWorkgroupSize;
+    uint32_t scale = 1;
+    uint32_t pipelineGeneration = 0;
+
+    bool reuseCommandBuffers = true;
+    double lastSubmitMicroseconds = 0.0;
+
+    VkShaderModule compShaderModule = VK_NULL_HANDLE;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline computePipeline = VK_NULL_HANDLE;
+    // False for handles borrowed from a KernelRegistry, which destroys them
+    bool ownsLayouts = true;
+    bool ownsPipeline = true;
+    // Buffers, command buffers and fence of run(), with timestamps around the dispatch
+    std::unique_ptr<JobSlot> slot;
+};
+
+// Workgroup counts covering elements invocations as a 2D grid of workgroups
+void dispatchGroupCounts(const VkPhysicalDeviceLimits& limits, uint32_t elements, uint32_t workgroupSize,
+    uint32_t& groupCountX, uint32_t& groupCountY);
+void beginOneTimeCommandBuffer(VkCommandBuffer cmdBuffer);
+void beginReusableCommandBuffer(VkCommandBuffer cmdBuffer);
+void memoryBarrier(VkCommandBuffer cmdBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
@@ -0,0 +1,123 @@
+#include "cpu_kernel.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC emits any intrinsic regardless of /arch, so no per-function target is needed
+#define CPU_KERNEL_TARGET(isa)
+#else
+#define CPU_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Avx2:
+        return "AVX2";
+    case SimdLevel::Sse41:
+        return "SSE4.1";
+    default:
+        return "scalar";
+    }
+}
+
+static void squareScalar(const uint32_t* input, uint32_t* output, size_t elements, uint32_t scale) {
+    for (size_t i = 0; i < elements; ++i) {
+        output[i] = input[i] * input[i] * scale;
+    }
+}
+
+#ifdef CPU_KERNEL_X86
+// pmulld keeps the low 32 bits of each product, which matches uint overflow in GLSL
+CPU_KERNEL_TARGET("sse4.1")
+static void squareSse41(const uint32_t* input, uint32_t* output, size_t elements, uint32_t scale) {
+    const __m128i scales = _mm_set1_epi32(static_cast<int>(scale));
+    size_t i = 0;
+    for (; i + 4 <= elements; i += 4) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        __m128i squares = _mm_mullo_epi32(values, values);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_mullo_epi32(squares, scales));
+    }
+    squareScalar(input + i, output + i, elements - i, scale);
+}
+
+CPU_KERNEL_TARGET("avx2")
+static void squareAvx2(const uint32_t* input, uint32_t* output, size_t elements, uint32_t scale) {
+    const __m256i scales = _mm256_set1_epi32(static_cast<int>(scale));
+    size_t i = 0;
+    for (; i + 8 <= elements; i += 8) {
+        __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+        __m256i squares = _mm256_mullo_epi32(values, values);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_mullo_epi32(squares, scales));
+    }
+    squareScalar(input + i, output + i, elements - i, scale);
+}
+#endif
+
+SimdLevel CpuKernel::detectSimdLevel() {
+#if defined(CPU_KERNEL_X86) && defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    // AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (avx2) {
+        return SimdLevel::Avx2;
+    }
+    if (sse41) {
+        return SimdLevel::Sse41;
+    }
+#elif defined(CPU_KERNEL_X86)
+    // Checks OS support for the wider registers as well
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::Avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::Sse41;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+CpuKernel::CpuKernel(ThreadPool* pool)
+    : pool(pool), simdLevel(detectSimdLevel()), square(squareScalar) {
+#ifdef CPU_KERNEL_X86
+    if (simdLevel == SimdLevel::Avx2) {
+        square = squareAvx2;
+    }
+    else if (simdLevel == SimdLevel::Sse41) {
+        square = squareSse41;
+    }
+#endif
+}
+
+void CpuKernel::run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output) const {
+    output.resize(input.size());
+    run(input.data(), output.data(), input.size());
+}
+
+void CpuKernel::run(const uint32_t* input, uint32_t* output, size_t elements) const {
+    if (pool == nullptr || elements < 2 * minElementsPerThread) {
+        square(input, output, elements, scale);
+        return;
+    }
+
+    SquareFunction squareRange = square;
+    const uint32_t rangeScale = scale;
+    pool->parallelFor(elements, minElementsPerThread, [=](size_t begin, size_t end) {
+        squareRange(input + begin, output + begin, end - begin, rangeScale);
+    });
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class SimdLevel {
+    Scalar,
+    Sse41,
+    Avx2
+};
+
+const char* simdLevelName(SimdLevel level);
+
+// Host implementation of compute_shader.comp (out[i] = in[i] * in[i] * scale). The
+// widest instruction set the CPU supports is picked at runtime, and jobs large
+// enough to be worth it are split across a thread pool. Used to verify GPU
+// output and to run jobs that are too small to amortize a Vulkan submission.
+class CpuKernel {
+public:
+    // Below this many elements per thread the split costs more than it saves
+    static constexpr size_t minElementsPerThread = 1 << 16;
+
+    // pool may be null to run single-threaded
+    explicit CpuKernel(ThreadPool* pool = nullptr);
+
+    void run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output) const;
+    void run(const uint32_t* input, uint32_t* output, size_t elements) const;
+
+    // Must match the scale pushed to the GPU kernel for verification to pass
+    uint32_t getScale() const { return scale; }
+    void setScale(uint32_t value) { scale = value; }
+
+    SimdLevel getSimdLevel() const { return simdLevel; }
+    uint32_t getThreadCount() const { return pool != nullptr ? pool->getConcurrency() : 1; }
+
+    static SimdLevel detectSimdLevel();
+
+private:
+    using SquareFunction = void (*)(const uint32_t* input, uint32_t* output, size_t elements, uint32_t scale);
+
+    ThreadPool* pool;
+    uint32_t scale = 1;
+    SimdLevel simdLevel;
+    SquareFunction square;
+};
@@ -0,0 +1,349 @@
+#include "job_slot.hpp"
+
+#include <stdexcept>
+
+
+JobSlot::JobSlot(ComputeContext& context, const ComputeKernel& kernel, uint32_t queueIndex, bool timeDispatch)
+    : context(context), kernel(kernel) {
+    VkDevice vulkanDevice = context.getDevice();
+    memoryMode = kernel.getMemoryMode();
+    useTransferQueue = kernel.usesTransferQueue();
+    queue = context.getQueue(queueIndex);
+
+    try {
+        descriptorSet = context.allocateDescriptorSet(kernel.getDescriptorSetLayout());
+
+        // Allocate command buffers
+        VkCommandBufferAllocateInfo cmdBufferAllocateInfo = {};
+        cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufferAllocateInfo.commandPool = context.getCommandPool();
+        cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufferAllocateInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(vulkanDevice, &cmdBufferAllocateInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to allocate command buffers");
+        }
+
+        VkFenceCreateInfo fenceCreateInfo = {};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        if (vkCreateFence(vulkanDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create fence");
+        }
+
+        if (timeDispatch && context.supportsTimestamps()) {
+            VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+            queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolCreateInfo.queryCount = 2;
+
+            if (vkCreateQueryPool(vulkanDevice, &queryPoolCreateInfo, nullptr, &timestampQueryPool) != VK_SUCCESS) {
+                throw std::runtime_error("RUNTIME ERROR: Failed to create timestamp query pool");
+            }
+        }
+
+        if (!useTransferQueue) {
+            return;
+        }
+
+        cmdBufferAllocateInfo.commandPool = context.getTransferCommandPool();
+        cmdBufferAllocateInfo.commandBufferCount = 2;
+
+        VkCommandBuffer transferCommandBuffers[2];
+        if (vkAllocateCommandBuffers(vulkanDevice, &cmdBufferAllocateInfo, transferCommandBuffers) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to allocate transfer command buffers");
+        }
+        uploadCommandBuffer = transferCommandBuffers[0];
+        readbackCommandBuffer = transferCommandBuffers[1];
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        if (vkCreateSemaphore(vulkanDevice, &semaphoreCreateInfo, nullptr, &uploadSemaphore) != VK_SUCCESS ||
+            vkCreateSemaphore(vulkanDevice, &semaphoreCreateInfo, nullptr, &computeSemaphore) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create semaphore");
+        }
+    }
+    catch (...) {
+        destroy();
+        throw;
+    }
+}
+
+JobSlot::~JobSlot() {
+    destroy();
+}
+
+void JobSlot::destroy() {
+    VkDevice vulkanDevice = context.getDevice();
+
+    destroyBuffers();
+    if (useTransferQueue) {
+        vkDestroySemaphore(vulkanDevice, uploadSemaphore, nullptr);
+        vkDestroySemaphore(vulkanDevice, computeSemaphore, nullptr);
+        VkCommandBuffer transferCommandBuffers[] = { uploadCommandBuffer, readbackCommandBuffer };
+        vkFreeCommandBuffers(vulkanDevice, context.getTransferCommandPool(), 2, transferCommandBuffers);
+    }
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(vulkanDevice, timestampQueryPool, nullptr);
+    }
+    vkDestroyFence(vulkanDevice, fence, nullptr);
+    vkFreeCommandBuffers(vulkanDevice, context.getCommandPool(), 1, &commandBuffer);
+    context.freeDescriptorSet(descriptorSet);
+}
+
+void JobSlot::reserve(uint32_t elements) {
+    if (elements <= capacity) {
+        return;
+    }
+    destroyBuffers();
+    createBuffers(elements);
+}
+
+void JobSlot::createBuffers(uint32_t elements) {
+    const VkDeviceSize bufferSize = static_cast<VkDeviceSize>(elements) * sizeof(uint32_t);
+    const HostAccess uploadAccess = hostAccessFor(memoryMode, HostAccess::Upload);
+    const HostAccess readbackAccess = hostAccessFor(memoryMode, HostAccess::Readback);
+
+    MemoryArena& arena = context.getMemoryArena();
+    try {
+        if (isHostMemoryMode(memoryMode)) {
+            arena.createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, uploadAccess, inBuffer, inBufferMemory);
+            arena.createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, readbackAccess, outBuffer, outBufferMemory);
+        }
+        else {
+            arena.createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, inBuffer, inBufferMemory, useTransferQueue);
+            arena.createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outBuffer, outBufferMemory, useTransferQueue);
+            arena.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, uploadAccess,
+                stagingInBuffer, stagingInBufferMemory, useTransferQueue);
+            arena.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, readbackAccess,
+                stagingOutBuffer, stagingOutBufferMemory, useTransferQueue);
+        }
+    }
+    catch (...) {
+        destroyBuffers();
+        throw;
+    }
+    capacity = elements;
+
+    // The job size is pushed per dispatch, so the descriptors cover the whole
+    // buffers and are only rewritten when the buffers change
+    kernel.writeDescriptorSet(descriptorSet, inBuffer, outBuffer, capacity);
+    commandBuffersRecorded = false;
+}
+
+void JobSlot::destroyBuffers() {
+    // Also used to unwind a partial createBuffers(); null handles are skipped
+    MemoryArena& arena = context.getMemoryArena();
+    arena.destroyBuffer(inBuffer, inBufferMemory);
+    arena.destroyBuffer(outBuffer, outBufferMemory);
+    arena.destroyBuffer(stagingInBuffer, stagingInBufferMemory);
+    arena.destroyBuffer(stagingOutBuffer, stagingOutBufferMemory);
+    capacity = 0;
+}
+
+void* JobSlot::getUploadData() const {
+    return isHostMemoryMode(memoryMode) ? inBufferMemory.mapped : stagingInBufferMemory.mapped;
+}
+
+const void* JobSlot::getReadbackData(uint32_t elements) const {
+    const ArenaAllocation& readbackMemory = isHostMemoryMode(memoryMode) ? outBufferMemory : stagingOutBufferMemory;
+    context.getMemoryArena().invalidate(readbackMemory, 0, static_cast<VkDeviceSize>(elements) * sizeof(uint32_t));
+    return readbackMemory.mapped;
+}
+
+void JobSlot::wait() const {
+    vkWaitForFences(context.getDevice(), 1, &fence, true, UINT64_MAX);
+}
+
+void JobSlot::submit(uint32_t elements, VkSemaphore timelineSemaphore, uint64_t signalValue) {
+    if (elements > capacity) {
+        throw std::runtime_error("RUNTIME ERROR: Job exceeds slot capacity");
+    }
+
+    const ArenaAllocation& uploadMemory = isHostMemoryMode(memoryMode) ? inBufferMemory : stagingInBufferMemory;
+    context.getMemoryArena().flush(uploadMemory, 0, static_cast<VkDeviceSize>(elements) * sizeof(uint32_t));
+
+    // Repeated jobs of the same size resubmit the recorded command buffers.
+    // With reuse off they are recorded for one submit only, so they never
+    // count as recorded.
+    const bool reuse = kernel.getCommandBufferReuse();
+    const uint32_t scale = kernel.getScale();
+    const uint32_t pipelineGeneration = kernel.getPipelineGeneration();
+    if (!reuse || !commandBuffersRecorded || elements != recordedElements || scale != recordedScale ||
+        pipelineGeneration != recordedPipelineGeneration) {
+        if (useTransferQueue) {
+            recordStagedWithTransferQueue(elements, reuse);
+        }
+        else {
+            recordSingleQueue(elements, reuse);
+        }
+        recordedElements = elements;
+        recordedScale = scale;
+        recordedPipelineGeneration = pipelineGeneration;
+        commandBuffersRecorded = reuse;
+        ++recordCount;
+    }
+
+    VkFence signalFence = VK_NULL_HANDLE;
+    if (timelineSemaphore == VK_NULL_HANDLE) {
+        vkResetFences(context.getDevice(), 1, &fence);
+        signalFence = fence;
+    }
+
+    // The wait on the binary computeSemaphore needs no value, so only the
+    // timeline signal gets one
+    VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = {};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineSubmitInfo.signalSemaphoreValueCount = 1;
+    timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
+
+    if (!useTransferQueue) {
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        if (timelineSemaphore != VK_NULL_HANDLE) {
+            submitInfo.pNext = &timelineSubmitInfo;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &timelineSemaphore;
+        }
+
+        if (vkQueueSubmit(queue, 1, &submitInfo, signalFence) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed submit command buffer to queue");
+        }
+        return;
+    }
+
+    VkSubmitInfo uploadSubmitInfo = {};
+    uploadSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    uploadSubmitInfo.commandBufferCount = 1;
+    uploadSubmitInfo.pCommandBuffers = &uploadCommandBuffer;
+    uploadSubmitInfo.signalSemaphoreCount = 1;
+    uploadSubmitInfo.pSignalSemaphores = &uploadSemaphore;
+
+    const VkPipelineStageFlags computeWaitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkSubmitInfo computeSubmitInfo = {};
+    computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    computeSubmitInfo.waitSemaphoreCount = 1;
+    computeSubmitInfo.pWaitSemaphores = &uploadSemaphore;
+    computeSubmitInfo.pWaitDstStageMask = &computeWaitStage;
+    computeSubmitInfo.commandBufferCount = 1;
+    computeSubmitInfo.pCommandBuffers = &commandBuffer;
+    computeSubmitInfo.signalSemaphoreCount = 1;
+    computeSubmitInfo.pSignalSemaphores = &computeSemaphore;
+
+    const VkPipelineStageFlags readbackWaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo readbackSubmitInfo = {};
+    readbackSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    readbackSubmitInfo.waitSemaphoreCount = 1;
+    readbackSubmitInfo.pWaitSemaphores = &computeSemaphore;
+    readbackSubmitInfo.pWaitDstStageMask = &readbackWaitStage;
+    readbackSubmitInfo.commandBufferCount = 1;
+    readbackSubmitInfo.pCommandBuffers = &readbackCommandBuffer;
+    if (timelineSemaphore != VK_NULL_HANDLE) {
+        readbackSubmitInfo.pNext = &timelineSubmitInfo;
+        readbackSubmitInfo.signalSemaphoreCount = 1;
+        readbackSubmitInfo.pSignalSemaphores = &timelineSemaphore;
+    }
+
+    if (vkQueueSubmit(context.getTransferQueue(), 1, &uploadSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS ||
+        vkQueueSubmit(queue, 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS ||
+        vkQueueSubmit(context.getTransferQueue(), 1, &readbackSubmitInfo, signalFence) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed submit command buffer to queue");
+    }
+}
+
+static void beginCommandBuffer(VkCommandBuffer cmdBuffer, bool reusable) {
+    if (reusable) {
+        beginReusableCommandBuffer(cmdBuffer);
+    }
+    else {
+        beginOneTimeCommandBuffer(cmdBuffer);
+    }
+}
+
+void JobSlot::recordTimedDispatch(uint32_t elements) {
+    if (timestampQueryPool == VK_NULL_HANDLE) {
+        kernel.recordDispatch(commandBuffer, descriptorSet, elements);
+        return;
+    }
+
+    // TOP_OF_PIPE does not wait for earlier commands in the same command
+    // buffer, so on the single-queue staged path the start may overlap the upload copy
+    vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 0, 2);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 0);
+    kernel.recordDispatch(commandBuffer, descriptorSet, elements);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 1);
+}
+
+bool JobSlot::readDispatchMilliseconds(double& milliseconds) const {
+    if (timestampQueryPool == VK_NULL_HANDLE) {
+        return false;
+    }
+
+    uint64_t timestamps[2] = {};
+    if (vkGetQueryPoolResults(context.getDevice(), timestampQueryPool, 0, 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+        return false;
+    }
+
+    // Only the low timestampValidBits bits are meaningful; masking the
+    // difference also handles a counter wrap between the two queries
+    const uint32_t validBits = context.getTimestampValidBits();
+    const uint64_t mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    const uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+    milliseconds = ticks * static_cast<double>(context.getDeviceProperties().limits.timestampPeriod) / 1e6;
+    return true;
+}
+
+void JobSlot::recordSingleQueue(uint32_t elements, bool reusable) {
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = elements * sizeof(uint32_t);
+
+    // In DeviceLocal mode upload, dispatch and readback share one command buffer
+    beginCommandBuffer(commandBuffer, reusable);
+    if (memoryMode == MemoryMode::DeviceLocal) {
+        vkCmdCopyBuffer(commandBuffer, stagingInBuffer, inBuffer, 1, &copyRegion);
+        memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+    recordTimedDispatch(elements);
+    if (memoryMode == MemoryMode::DeviceLocal) {
+        memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        vkCmdCopyBuffer(commandBuffer, outBuffer, stagingOutBuffer, 1, &copyRegion);
+        memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    }
+    else {
+        memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    }
+    vkEndCommandBuffer(commandBuffer);
+}
+
+void JobSlot::recordStagedWithTransferQueue(uint32_t elements, bool reusable) {
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = elements * sizeof(uint32_t);
+
+    // Upload and readback on the transfer queue, so the copies of neighbouring
+    // jobs overlap with this job's dispatch. The buffers use concurrent
+    // sharing, and semaphore waits make the previous queue's writes visible,
+    // so no barriers are needed between the queues.
+    beginCommandBuffer(uploadCommandBuffer, reusable);
+    vkCmdCopyBuffer(uploadCommandBuffer, stagingInBuffer, inBuffer, 1, &copyRegion);
+    vkEndCommandBuffer(uploadCommandBuffer);
+
+    beginCommandBuffer(commandBuffer, reusable);
+    recordTimedDispatch(elements);
+    vkEndCommandBuffer(commandBuffer);
+
+    beginCommandBuffer(readbackCommandBuffer, reusable);
+    vkCmdCopyBuffer(readbackCommandBuffer, outBuffer, stagingOutBuffer, 1, &copyRegion);
+    memoryBarrier(readbackCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    vkEndCommandBuffer(readbackCommandBuffer);
+}
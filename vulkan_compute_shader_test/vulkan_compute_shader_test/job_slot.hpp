@@ -0,0 +1,93 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "compute_kernel.hpp"
+#include "memory_arena.hpp"
+
+// Everything one job needs to be in flight against a kernel's pipeline while
+// other jobs are: its own storage and staging buffers, descriptor set, command
+// buffers and fence. StreamRunner and AsyncCompute keep a ring of these, so
+// the host can fill one slot while the GPU works on the others.
+//
+// ComputeKernel::run() itself goes through a slot of the kernel's.
+//
+// Staging copies go to the transfer queue when the kernel uses it, chained to
+// the dispatch with the slot's binary semaphores. The dispatch goes to compute
+// queue queueIndex of the context. With timeDispatch the dispatch is wrapped in
+// timestamp queries, when the queue supports them.
+class JobSlot {
+public:
+    JobSlot(ComputeContext& context, const ComputeKernel& kernel, uint32_t queueIndex = 0, bool timeDispatch = false);
+    ~JobSlot();
+
+    JobSlot(const JobSlot&) = delete;
+    JobSlot& operator=(const JobSlot&) = delete;
+
+    // Grows the buffers to hold at least elements; contents are not preserved
+    void reserve(uint32_t elements);
+    uint32_t getCapacity() const { return capacity; }
+
+    // Host-visible memory the input is written to and the output is read from.
+    // submit() flushes the upload range; getReadbackData() invalidates the
+    // first elements of the output, so call it once the job has completed.
+    void* getUploadData() const;
+    const void* getReadbackData(uint32_t elements) const;
+
+    // Submits upload, dispatch and readback for elements, recording the command
+    // buffers only when the size or kernel parameters changed since the last
+    // submit, or on every submit while the kernel's command buffer reuse is off.
+    // Completion signals the slot's fence, or timelineSemaphore with
+    // signalValue when given.
+    void submit(uint32_t elements, VkSemaphore timelineSemaphore = VK_NULL_HANDLE, uint64_t signalValue = 0);
+    // Waits for the fence of the last submit() without a timeline semaphore
+    void wait() const;
+    uint32_t getRecordCount() const { return recordCount; }
+
+    bool hasTimestamps() const { return timestampQueryPool != VK_NULL_HANDLE; }
+    // GPU time between the timestamps around the last completed dispatch;
+    // false when there are none or they could not be read
+    bool readDispatchMilliseconds(double& milliseconds) const;
+
+private:
+    // Releases every handle created so far; also unwinds a failed constructor
+    void destroy();
+    void createBuffers(uint32_t elements);
+    void destroyBuffers();
+    void recordTimedDispatch(uint32_t elements);
+    void recordSingleQueue(uint32_t elements, bool reusable);
+    void recordStagedWithTransferQueue(uint32_t elements, bool reusable);
+
+    ComputeContext& context;
+    const ComputeKernel& kernel;
+    MemoryMode memoryMode;
+    bool useTransferQueue = false;
+    VkQueue queue = VK_NULL_HANDLE;
+
+    uint32_t capacity = 0;
+    bool commandBuffersRecorded = false;
+    uint32_t recordedElements = 0;
+    uint32_t recordedScale = 0;
+    uint32_t recordedPipelineGeneration = 0;
+    uint32_t recordCount = 0;
+    VkBuffer inBuffer = VK_NULL_HANDLE;
+    VkBuffer outBuffer = VK_NULL_HANDLE;
+    ArenaAllocation inBufferMemory;
+    ArenaAllocation outBufferMemory;
+    // Only used in DeviceLocal mode
+    VkBuffer stagingInBuffer = VK_NULL_HANDLE;
+    VkBuffer stagingOutBuffer = VK_NULL_HANDLE;
+    ArenaAllocation stagingInBufferMemory;
+    ArenaAllocation stagingOutBufferMemory;
+
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    // Two timestamps around the dispatch; null unless timeDispatch was asked
+    // for and the queue supports timestamps
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    // Only used by the transfer queue path
+    VkCommandBuffer uploadCommandBuffer = VK_NULL_HANDLE;
+    VkCommandBuffer readbackCommandBuffer = VK_NULL_HANDLE;
+    VkSemaphore uploadSemaphore = VK_NULL_HANDLE;
+    VkSemaphore computeSemaphore = VK_NULL_HANDLE;
+};
@@ -0,0 +1,510 @@
+#include "kernel_registry.hpp"
+#include "compute_kernel.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+
+// The few SPIR-V opcodes, decorations and storage classes the interface
+// check looks at (SPIR-V specification, section 3)
+namespace spirv {
+const uint32_t magic = 0x07230203;
+const uint32_t headerWords = 5;
+
+const uint32_t opEntryPoint = 15;
+const uint32_t opTypeInt = 21;
+const uint32_t opTypeFloat = 22;
+const uint32_t opTypeVector = 23;
+const uint32_t opTypeStruct = 30;
+const uint32_t opTypePointer = 32;
+const uint32_t opVariable = 59;
+const uint32_t opDecorate = 71;
+const uint32_t opMemberDecorate = 72;
+
+const uint32_t decorationBufferBlock = 3;
+const uint32_t decorationBinding = 33;
+const uint32_t decorationDescriptorSet = 34;
+const uint32_t decorationOffset = 35;
+
+const uint32_t storageClassUniformConstant = 0;
+const uint32_t storageClassUniform = 2;
+const uint32_t storageClassPushConstant = 9;
+const uint32_t storageClassStorageBuffer = 12;
+
+const uint32_t executionModelGLCompute = 5;
+}
+
+// Checks a module against the interface every registered kernel shares (see
+// KernelRegistry). Returns why it does not match, or an empty string.
+static std::string checkKernelInterface(const std::vector<char>& code) {
+    if (code.size() % sizeof(uint32_t) != 0 || code.size() < spirv::headerWords * sizeof(uint32_t)) {
+        return "not a SPIR-V module";
+    }
+    std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+    memcpy(words.data(), code.data(), code.size());
+    if (words[0] != spirv::magic) {
+        return "not a SPIR-V module";
+    }
+
+    bool hasComputeMain = false;
+    std::map<uint32_t, uint32_t> bindings;
+    std::map<uint32_t, uint32_t> descriptorSets;
+    std::set<uint32_t> bufferBlocks;
+    std::map<uint32_t, std::vector<uint32_t>> memberOffsets;
+    std::map<uint32_t, std::vector<uint32_t>> structMembers;
+    std::map<uint32_t, uint32_t> scalarSizes;
+    std::map<uint32_t, std::pair<uint32_t, uint32_t>> vectorTypes;
+    std::map<uint32_t, std::pair<uint32_t, uint32_t>> pointerTypes;
+    std::vector<std::pair<uint32_t, uint32_t>> variables;
+
+    for (size_t i = spirv::headerWords; i < words.size(); ) {
+        const uint32_t wordCount = words[i] >> 16;
+        const uint32_t opcode = words[i] & 0xffff;
+        if (wordCount == 0 || i + wordCount > words.size()) {
+            return "truncated SPIR-V module";
+        }
+        const uint32_t* operands = &words[i + 1];
+
+        if (opcode == spirv::opEntryPoint && wordCount >= 4) {
+            const char* name = reinterpret_cast<const char*>(&operands[2]);
+            const size_t maxLength = (wordCount - 3) * sizeof(uint32_t);
+            if (operands[0] == spirv::executionModelGLCompute && strncmp(name, "main", maxLength) == 0) {
+                hasComputeMain = true;
+            }
+        }
+        else if (opcode == spirv::opDecorate && wordCount >= 3) {
+            if (operands[1] == spirv::decorationBinding && wordCount >= 4) {
+                bindings[operands[0]] = operands[2];
+            }
+            else if (operands[1] == spirv::decorationDescriptorSet && wordCount >= 4) {
+                descriptorSets[operands[0]] = operands[2];
+            }
+            else if (operands[1] == spirv::decorationBufferBlock) {
+                bufferBlocks.insert(operands[0]);
+            }
+        }
+        else if (opcode == spirv::opMemberDecorate && wordCount >= 5 && operands[2] == spirv::decorationOffset) {
+            std::vector<uint32_t>& offsets = memberOffsets[operands[0]];
+            offsets.resize(std::max<size_t>(offsets.size(), operands[1] + 1));
+            offsets[operands[1]] = operands[3];
+        }
+        else if ((opcode == spirv::opTypeInt || opcode == spirv::opTypeFloat) && wordCount >= 3) {
+            scalarSizes[operands[0]] = operands[1] / 8;
+        }
+        else if (opcode == spirv::opTypeVector && wordCount >= 4) {
+            vectorTypes[operands[0]] = std::make_pair(operands[1], operands[2]);
+        }
+        else if (opcode == spirv::opTypeStruct && wordCount >= 2) {
+            structMembers[operands[0]].assign(operands + 1, operands + wordCount - 1);
+        }
+        else if (opcode == spirv::opTypePointer && wordCount >= 4) {
+            pointerTypes[operands[0]] = std::make_pair(operands[1], operands[2]);
+        }
+        else if (opcode == spirv::opVariable && wordCount >= 4) {
+            variables.push_back(std::make_pair(operands[0], operands[1]));
+        }
+        i += wordCount;
+    }
+
+    if (!hasComputeMain) {
+        return "no GLCompute entry point named main";
+    }
+
+    auto typeSize = [&](uint32_t type) -> uint32_t {
+        auto scalar = scalarSizes.find(type);
+        if (scalar != scalarSizes.end()) {
+            return scalar->second;
+        }
+        auto vector = vectorTypes.find(type);
+        if (vector != vectorTypes.end() && scalarSizes.count(vector->second.first) != 0) {
+            return scalarSizes[vector->second.first] * vector->second.second;
+        }
+        return 0;
+    };
+
+    std::set<uint32_t> usedBindings;
+    for (const auto& variable : variables) {
+        auto pointer = pointerTypes.find(variable.first);
+        if (pointer == pointerTypes.end()) {
+            continue;
+        }
+        const uint32_t storageClass = pointer->second.first;
+        const uint32_t pointee = pointer->second.second;
+
+        if (storageClass == spirv::storageClassPushConstant) {
+            // Every member must be a scalar or vector inside KernelParameters
+            const std::vector<uint32_t>& members = structMembers[pointee];
+            const std::vector<uint32_t>& offsets = memberOffsets[pointee];
+            for (size_t member = 0; member < members.size(); ++member) {
+                const uint32_t size = typeSize(members[member]);
+                if (size == 0 || member >= offsets.size() || offsets[member] + size > sizeof(KernelParameters)) {
+                    return "push constants larger than KernelParameters";
+                }
+            }
+            continue;
+        }
+        if (storageClass != spirv::storageClassUniformConstant && storageClass != spirv::storageClassUniform &&
+            storageClass != spirv::storageClassStorageBuffer) {
+            continue;
+        }
+
+        // Before SPIR-V 1.3 storage buffers are Uniform blocks decorated BufferBlock
+        const bool storageBuffer = storageClass == spirv::storageClassStorageBuffer ||
+            (storageClass == spirv::storageClassUniform && bufferBlocks.count(pointee) != 0);
+        const uint32_t set = descriptorSets.count(variable.second) != 0 ? descriptorSets[variable.second] : 0;
+        const uint32_t binding = bindings.count(variable.second) != 0 ? bindings[variable.second] : 0;
+        if (!storageBuffer || set != 0 || binding > 1) {
+            return "uses a resource other than the storage buffers at set 0, bindings 0 and 1 (set " +
+                std::to_string(set) + ", binding " + std::to_string(binding) + ")";
+        }
+        if (!usedBindings.insert(binding).second) {
+            return "declares binding " + std::to_string(binding) + " twice";
+        }
+    }
+    return std::string();
+}
+
+KernelRegistry::KernelRegistry(ComputeContext& context, uint32_t requestedWorkgroupSize, bool usePipelineCache)
+    : context(context), usePipelineCache(usePipelineCache) {
+    const uint32_t maxSize = ComputeKernel::maxWorkgroupSize(context.getDeviceProperties().limits);
+    workgroupSize = std::min(requestedWorkgroupSize == 0 ? ComputeKernel::defaultWorkgroupSize : requestedWorkgroupSize, maxSize);
+    createLayouts();
+}
+
+KernelRegistry::~KernelRegistry() {
+    VkDevice vulkanDevice = context.getDevice();
+    vkDeviceWaitIdle(vulkanDevice);
+
+    for (auto& entry : entries) {
+        if (entry.second.pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(vulkanDevice, entry.second.pipeline, nullptr);
+        }
+    }
+    for (auto& module : modules) {
+        vkDestroyShaderModule(vulkanDevice, module.second.second, nullptr);
+    }
+    vkDestroyPipelineLayout(vulkanDevice, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(vulkanDevice, descriptorSetLayout, nullptr);
+}
+
+void KernelRegistry::createLayouts() {
+    VkDevice vulkanDevice = context.getDevice();
+
+    // Create descriptor set layout
+    VkDescriptorSetLayoutBinding descriptorSetLayoutBindings[2];
+
+    for (uint32_t i = 0; i < 2; i++) {
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = i;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags |= VK_SHADER_STAGE_COMPUTE_BIT;
+        descriptorSetLayoutBindings[i] = binding;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = 2;
+    descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings;
+
+    if (vkCreateDescriptorSetLayout(vulkanDevice, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor set layout");
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(KernelParameters);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(vulkanDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create pipeline layout");
+    }
+}
+
+void KernelRegistry::scanDirectory(const std::string& directory) {
+    std::vector<std::filesystem::path> paths;
+    for (const auto& item : std::filesystem::directory_iterator(directory)) {
+        if (item.is_regular_file() && item.path().extension() == ".spv") {
+            paths.push_back(item.path());
+        }
+    }
+    // Directory order is unspecified; keep runs reproducible
+    std::sort(paths.begin(), paths.end());
+
+    for (const auto& path : paths) {
+        add(path.stem().string(), path.string());
+    }
+}
+
+void KernelRegistry::loadManifest(const std::string& manifestPath) {
+    std::ifstream file(manifestPath);
+    if (!file.is_open()) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to open kernel manifest " + manifestPath);
+    }
+
+    const std::filesystem::path baseDirectory = std::filesystem::path(manifestPath).parent_path();
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        std::string name;
+        std::string path;
+        if (!(fields >> name)) {
+            continue;
+        }
+        if (!(fields >> path)) {
+            throw std::runtime_error("RUNTIME ERROR: Kernel manifest entry " + name + " has no path");
+        }
+
+        const std::filesystem::path shaderPath(path);
+        add(name, shaderPath.is_absolute() ? path : (baseDirectory / shaderPath).string());
+    }
+}
+
+void KernelRegistry::addPath(const std::string& path) {
+    if (std::filesystem::is_directory(path)) {
+        scanDirectory(path);
+    }
+    else {
+        loadManifest(path);
+    }
+}
+
+void KernelRegistry::add(const std::string& name, const std::string& shaderPath) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.count(name) != 0) {
+        throw std::runtime_error("RUNTIME ERROR: Kernel " + name + " is registered twice");
+    }
+    entries[name].path = shaderPath;
+}
+
+void KernelRegistry::loadEntry(Entry& entry) {
+    entry.code = readFile(entry.path);
+    entry.hash = hashBytes(entry.code);
+    entry.interfaceError = checkKernelInterface(entry.code);
+    entry.loaded = true;
+}
+
+void KernelRegistry::loadCompatibleEntry(const std::string& name, Entry& entry) {
+    if (!entry.loaded) {
+        loadEntry(entry);
+    }
+    if (!entry.interfaceError.empty()) {
+        throw std::runtime_error("RUNTIME ERROR: Kernel " + name + " does not match the kernel interface: " + entry.interfaceError);
+    }
+    resolveModule(entry);
+}
+
+void KernelRegistry::resolveModule(Entry& entry) {
+    if (entry.shaderModule != VK_NULL_HANDLE) {
+        return;
+    }
+
+    // The hash only narrows the search; the bytes decide
+    auto range = modules.equal_range(entry.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.first == entry.code) {
+            entry.shaderModule = it->second.second;
+            entry.code.clear();
+            return;
+        }
+    }
+
+    VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleCreateInfo.codeSize = entry.code.size();
+    shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(entry.code.data());
+
+    if (vkCreateShaderModule(context.getDevice(), &shaderModuleCreateInfo, nullptr, &entry.shaderModule) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create shader module for " + entry.path);
+    }
+    modules.emplace(entry.hash, std::make_pair(std::move(entry.code), entry.shaderModule));
+    entry.code.clear();
+}
+
+void KernelRegistry::createPipeline(Entry& entry) const {
+    // Workgroup size is baked into the pipeline through specialization constants 0-2
+    const uint32_t workgroupSizeData[3] = { workgroupSize, 1, 1 };
+
+    VkSpecializationMapEntry specializationMapEntries[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        specializationMapEntries[i].constantID = i;
+        specializationMapEntries[i].offset = i * sizeof(uint32_t);
+        specializationMapEntries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = 3;
+    specializationInfo.pMapEntries = specializationMapEntries;
+    specializationInfo.dataSize = sizeof(workgroupSizeData);
+    specializationInfo.pData = workgroupSizeData;
+
+    VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo = {};
+    pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineShaderStageCreateInfo.pName = "main";
+    pipelineShaderStageCreateInfo.module = entry.shaderModule;
+    pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.layout = pipelineLayout;
+    computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo;
+
+    const VkPipelineCache pipelineCache = usePipelineCache ? context.getPipelineCache() : VK_NULL_HANDLE;
+    if (vkCreateComputePipelines(context.getDevice(), pipelineCache, 1, &computePipelineCreateInfo, nullptr, &entry.pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create compute pipeline for " + entry.path);
+    }
+}
+
+void KernelRegistry::createAll(ThreadPool* pool) {
+    using Clock = std::chrono::steady_clock;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<Entry*> pending;
+    for (auto& entry : entries) {
+        if (entry.second.pipeline == VK_NULL_HANDLE && entry.second.interfaceError.empty()) {
+            pending.push_back(&entry.second);
+        }
+    }
+
+    auto forEachPending = [&](const std::function<void(Entry&)>& body) {
+        auto rangeBody = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                body(*pending[i]);
+            }
+        };
+        if (pool != nullptr) {
+            pool->parallelFor(pending.size(), 1, rangeBody);
+        }
+        else {
+            rangeBody(0, pending.size());
+        }
+    };
+
+    // File reads and hashing are independent; module lookup touches the
+    // shared map, so it stays on this thread
+    auto loadStart = Clock::now();
+    forEachPending([this](Entry& entry) {
+        if (!entry.loaded) {
+            loadEntry(entry);
+        }
+    });
+    // Kernels with a different interface drop out before any module is made
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [](const Entry* entry) {
+        return !entry->interfaceError.empty();
+    }), pending.end());
+    for (Entry* entry : pending) {
+        resolveModule(*entry);
+    }
+    auto loadEnd = Clock::now();
+
+    forEachPending([this](Entry& entry) {
+        createPipeline(entry);
+    });
+    auto pipelineEnd = Clock::now();
+
+    loadMilliseconds += std::chrono::duration<double, std::milli>(loadEnd - loadStart).count();
+    pipelineMilliseconds += std::chrono::duration<double, std::milli>(pipelineEnd - loadEnd).count();
+}
+
+VkPipeline KernelRegistry::getPipeline(const std::string& name) {
+    using Clock = std::chrono::steady_clock;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = entries.find(name);
+    if (found == entries.end()) {
+        throw std::runtime_error("RUNTIME ERROR: Unknown kernel " + name);
+    }
+    Entry& entry = found->second;
+    if (entry.pipeline != VK_NULL_HANDLE) {
+        return entry.pipeline;
+    }
+
+    auto loadStart = Clock::now();
+    loadCompatibleEntry(name, entry);
+    auto loadEnd = Clock::now();
+    createPipeline(entry);
+    auto pipelineEnd = Clock::now();
+
+    loadMilliseconds += std::chrono::duration<double, std::milli>(loadEnd - loadStart).count();
+    pipelineMilliseconds += std::chrono::duration<double, std::milli>(pipelineEnd - loadEnd).count();
+    return entry.pipeline;
+}
+
+VkShaderModule KernelRegistry::getShaderModule(const std::string& name) {
+    using Clock = std::chrono::steady_clock;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = entries.find(name);
+    if (found == entries.end()) {
+        throw std::runtime_error("RUNTIME ERROR: Unknown kernel " + name);
+    }
+    Entry& entry = found->second;
+    if (entry.shaderModule != VK_NULL_HANDLE) {
+        return entry.shaderModule;
+    }
+
+    auto loadStart = Clock::now();
+    loadCompatibleEntry(name, entry);
+    loadMilliseconds += std::chrono::duration<double, std::milli>(Clock::now() - loadStart).count();
+    return entry.shaderModule;
+}
+
+const KernelRegistry::Entry& KernelRegistry::findEntry(const std::string& name) const {
+    auto found = entries.find(name);
+    if (found == entries.end()) {
+        throw std::runtime_error("RUNTIME ERROR: Unknown kernel " + name);
+    }
+    return found->second;
+}
+
+bool KernelRegistry::contains(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.count(name) != 0;
+}
+
+std::string KernelRegistry::getPath(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return findEntry(name).path;
+}
+
+std::vector<std::string> KernelRegistry::getNames() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> names;
+    for (const auto& entry : entries) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+RegistryStats KernelRegistry::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    RegistryStats stats;
+    stats.kernelCount = static_cast<uint32_t>(entries.size());
+    stats.moduleCount = static_cast<uint32_t>(modules.size());
+    for (const auto& entry : entries) {
+        stats.pipelineCount += entry.second.pipeline != VK_NULL_HANDLE ? 1 : 0;
+        stats.skippedCount += entry.second.interfaceError.empty() ? 0 : 1;
+    }
+    stats.loadMilliseconds = loadMilliseconds;
+    stats.pipelineMilliseconds = pipelineMilliseconds;
+    return stats;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "thread_pool.hpp"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct RegistryStats {
+    uint32_t kernelCount = 0;
+    // Distinct SPIR-V blobs among the loaded kernels
+    uint32_t moduleCount = 0;
+    uint32_t pipelineCount = 0;
+    // Loaded kernels whose interface does not match (see KernelRegistry)
+    uint32_t skippedCount = 0;
+    double loadMilliseconds = 0.0;
+    double pipelineMilliseconds = 0.0;
+};
+
+// Named compute kernels found in a directory or listed in a manifest. Every
+// kernel shares the interface of compute_shader.comp: input and output
+// storage buffers at bindings 0 and 1, KernelParameters push constants and
+// local_size_x through specialization constant 0, so one descriptor set
+// layout and pipeline layout serve them all. Each file is checked against
+// that interface when it is loaded: a GLCompute "main" entry point, storage
+// buffers only at set 0, bindings 0 and 1, and push constants that fit in
+// KernelParameters. Other shaders, such as the ParallelPrimitives ones that
+// share the build directory, are skipped by createAll() and refused by
+// getPipeline().
+//
+// SPIR-V files are hashed on load and identical blobs share one
+// VkShaderModule. Pipelines are created lazily by getPipeline(), or all at
+// once by createAll(), which reads the files and creates the pipelines on
+// the thread pool; the pipeline cache is internally synchronized, so the
+// workers share the context's cache.
+class KernelRegistry {
+public:
+    // workgroupSize 0 uses ComputeKernel::defaultWorkgroupSize. Without
+    // usePipelineCache pipelines are compiled from scratch, for timings that
+    // must not depend on what earlier runs left in the context's cache.
+    explicit KernelRegistry(ComputeContext& context, uint32_t workgroupSize = 0, bool usePipelineCache = true);
+    ~KernelRegistry();
+
+    KernelRegistry(const KernelRegistry&) = delete;
+    KernelRegistry& operator=(const KernelRegistry&) = delete;
+
+    // Registers every *.spv file under its file name without the extension
+    void scanDirectory(const std::string& directory);
+    // Registers one "name path" pair per line; # starts a comment and
+    // relative paths are resolved against the manifest's directory
+    void loadManifest(const std::string& manifestPath);
+    // A directory is scanned, anything else is read as a manifest
+    void addPath(const std::string& path);
+    void add(const std::string& name, const std::string& shaderPath);
+
+    // Loads and creates everything not created yet, skipping kernels with a
+    // different interface; pool may be null
+    void createAll(ThreadPool* pool);
+    // Loads the kernel's module and pipeline on first use; throws when the
+    // kernel does not match the interface
+    VkPipeline getPipeline(const std::string& name);
+    // Loads the kernel's module without creating a pipeline, for callers that
+    // specialize their own (see ComputeKernel)
+    VkShaderModule getShaderModule(const std::string& name);
+
+    bool contains(const std::string& name) const;
+    std::string getPath(const std::string& name) const;
+    std::vector<std::string> getNames() const;
+    VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+    VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
+    uint32_t getWorkgroupSize() const { return workgroupSize; }
+    RegistryStats getStats() const;
+
+private:
+    struct Entry {
+        std::string path;
+        std::vector<char> code;
+        uint64_t hash = 0;
+        bool loaded = false;
+        // Why the module does not match the kernel interface; empty when it does
+        std::string interfaceError;
+        VkShaderModule shaderModule = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+    };
+
+    void createLayouts();
+    void loadEntry(Entry& entry);
+    // Loads the entry and its module, throwing if the interface does not match
+    void loadCompatibleEntry(const std::string& name, Entry& entry);
+    // Looks up or creates the module for an entry whose code is loaded
+    void resolveModule(Entry& entry);
+    void createPipeline(Entry& entry) const;
+    const Entry& findEntry(const std::string& name) const;
+
+    ComputeContext& context;
+    uint32_t workgroupSize;
+    bool usePipelineCache;
+    std::map<std::string, Entry> entries;
+    // Modules by content hash; more than one per hash only after a collision
+    std::multimap<uint64_t, std::pair<std::vector<char>, VkShaderModule>> modules;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    double loadMilliseconds = 0.0;
+    double pipelineMilliseconds = 0.0;
+    mutable std::mutex mutex;
+};
@@ -6,469 +6,1089 @@
 #include <vec4.hpp>
 #include <mat4x4.hpp>
 
+#include "async_compute.hpp"
+#include "benchmark.hpp"
+#include "compute_context.hpp"
+#include "compute_graph.hpp"
+#include "compute_kernel.hpp"
+#include "cpu_kernel.hpp"
+#include "kernel_registry.hpp"
+#include "mapped_file_runner.hpp"
+#include "memory_arena.hpp"
+#include "micro_batcher.hpp"
+#include "offload_dispatcher.hpp"
+#include "parallel_primitives.hpp"
+#include "profiler.hpp"
+#include "stream_runner.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+#include "work_partitioner.hpp"
+#include "workgroup_tuner.hpp"
+
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <cassert>
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+
+static void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [--elements N] [--jobs N] [--memory auto|host|cached|device] [--no-transfer-queue]" << std::endl;
+    std::cout << "       [--pipeline-cache DIR] [--no-pipeline-cache] [--workgroup-size N] [--tune] [--tune-elements N]" << std::endl;
+    std::cout << "       [--stream INPUT OUTPUT] [--chunk-elements N] [--slots N] [--profile FILE] [--no-validation]" << std::endl;
+    std::cout << "       [--benchmark] [--bench-sizes LIST] [--bench-workgroup-sizes LIST] [--bench-memory LIST]" << std::endl;
+    std::cout << "       [--bench-warmup N] [--bench-iterations N] [--bench-output FILE]" << std::endl;
+    std::cout << "       [--verify] [--no-cpu-offload] [--cpu-offload-threshold N] [--cpu-threads N]" << std::endl;
+    std::cout << "       [--async] [--in-flight N] [--device N] [--devices LIST|all] [--queues N]" << std::endl;
+    std::cout << "       [--scale N] [--submit-cost] [--graph N] [--kernels DIR|MANIFEST]" << std::endl;
+    std::cout << "       [--map INPUT OUTPUT] [--no-host-import] [--batch THREADS] [--batch-elements N] [--batch-wait US]" << std::endl;
+    std::cout << "       [--primitives N] [--no-subgroups]" << std::endl;
+    std::cout << "    --elements N          Number of elements per job (default 10)" << std::endl;
+    std::cout << "    --jobs N              Run N jobs on one context and report per-job latency (default 1)" << std::endl;
+    std::cout << "    --memory MODE         Storage buffer placement: auto, host (host-visible), cached (host-cached) or device" << std::endl;
+    std::cout << "                          (device-local + staging)" << std::endl;
+    std::cout << "    --no-transfer-queue   Do staging copies on the compute queue even if a transfer queue exists" << std::endl;
+    std::cout << "    --pipeline-cache DIR  Directory for the on-disk pipeline cache (default .)" << std::endl;
+    std::cout << "    --no-pipeline-cache   Neither load nor save the pipeline cache" << std::endl;
+    std::cout << "    --workgroup-size N    Use local_size_x N instead of the tuned or default size" << std::endl;
+    std::cout << "    --tune                Time every candidate workgroup size and store the fastest for this device" << std::endl;
+    std::cout << "    --tune-elements N     Job size used while tuning (default 1048576)" << std::endl;
+    std::cout << "    --stream INPUT OUTPUT Stream little-endian uint32 values from INPUT to OUTPUT in chunks; - is stdin/stdout" << std::endl;
+    std::cout << "    --chunk-elements N    Elements per streamed or mapped chunk (default 4194304)" << std::endl;
+    std::cout << "    --slots N             Streamed chunks in flight at once (default 3)" << std::endl;
+    std::cout << "    --profile FILE        Write host phase and GPU timestamp timings to FILE (CSV for *.csv, JSON otherwise)" << std::endl;
+    std::cout << "    --no-validation       Do not enable the validation layer even if it is installed" << std::endl;
+    std::cout << "    --benchmark           Sweep sizes, workgroup sizes and memory modes against a host baseline" << std::endl;
+    std::cout << "                          (runs without the validation layer)" << std::endl;
+    std::cout << "    --bench-sizes LIST    Comma-separated buffer sizes in bytes, K/M/G suffixes allowed (default 4K..4G in steps of 4x)" << std::endl;
+    std::cout << "    --bench-workgroup-sizes LIST  Comma-separated local_size_x values (default: all powers of two)" << std::endl;
+    std::cout << "    --bench-memory LIST   Comma-separated memory modes (default: all supported)" << std::endl;
+    std::cout << "    --bench-warmup N      Untimed runs per configuration (default 2)" << std::endl;
+    std::cout << "    --bench-iterations N  Timed runs per configuration (default 10)" << std::endl;
+    std::cout << "    --bench-output FILE   Write benchmark results to FILE (CSV for *.csv, JSON otherwise)" << std::endl;
+    std::cout << "    --verify              Run every job on the GPU and compare the output with the CPU kernel" << std::endl;
+    std::cout << "    --no-cpu-offload      Run every job on the GPU, skipping the offload calibration" << std::endl;
+    std::cout << "    --cpu-offload-threshold N  Run jobs below N elements on the CPU instead of calibrating" << std::endl;
+    std::cout << "    --cpu-threads N       Threads used by the CPU kernel (default: all hardware threads)" << std::endl;
+    std::cout << "    --async               Submit the --jobs jobs without waiting for each one and report throughput" << std::endl;
+    std::cout << "    --in-flight N         Jobs in flight at once in --async mode (default 4)" << std::endl;
+    std::cout << "    --device N            Use physical device N instead of the highest scoring one" << std::endl;
+    std::cout << "                          (also settable through VULKAN_COMPUTE_DEVICE)" << std::endl;
+    std::cout << "    --devices LIST|all    Split every job across these devices, weighted by measured throughput" << std::endl;
+    std::cout << "    --queues N            Compute queues per device to split jobs across (default 1)" << std::endl;
+    std::cout << "    --scale N             Multiply every result by N, passed to the shader as a push constant (default 1)" << std::endl;
+    std::cout << "    --submit-cost         Compare host submit time with re-recorded and with reused command buffers" << std::endl;
+    std::cout << "    --graph N             Chain N passes of the kernel in one command buffer through device-local" << std::endl;
+    std::cout << "                          intermediates and check the result against the CPU kernel" << std::endl;
+    std::cout << "    --kernels DIR|MANIFEST  Register every *.spv in DIR, or the \"name path\" lines of MANIFEST, and compare" << std::endl;
+    std::cout << "                          lazy with eager parallel pipeline creation; compute_shader.comp is taken from there" << std::endl;
+    std::cout << "    --map INPUT OUTPUT    Memory-map INPUT and OUTPUT and import them as device memory when the device" << std::endl;
+    std::cout << "                          supports VK_EXT_external_memory_host, copying once per chunk otherwise" << std::endl;
+    std::cout << "    --no-host-import      Always take the copying path in --map mode" << std::endl;
+    std::cout << "    --batch THREADS       Send --jobs requests of --elements each from THREADS threads through the" << std::endl;
+    std::cout << "                          micro-batcher and compare with one submit per request" << std::endl;
+    std::cout << "    --batch-elements N    Dispatch a batch once it holds N elements (default 65536)" << std::endl;
+    std::cout << "    --batch-wait US       Dispatch a batch once its oldest request has waited US microseconds (default 200)" << std::endl;
+    std::cout << "    --primitives N        Run reduce, scan and radix sort over N random values and check them against" << std::endl;
+    std::cout << "                          std::accumulate, std::partial_sum and std::stable_sort" << std::endl;
+    std::cout << "    --no-subgroups        Use the shared-memory primitive shaders even when subgroup arithmetic is supported" << std::endl;
+}
 
+static bool parseMemoryMode(const std::string& name, MemoryMode& mode) {
+    if (name == "auto") {
+        mode = MemoryMode::Auto;
+    }
+    else if (name == "host") {
+        mode = MemoryMode::HostVisible;
+    }
+    else if (name == "cached") {
+        mode = MemoryMode::HostCached;
+    }
+    else if (name == "device") {
+        mode = MemoryMode::DeviceLocal;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
 
-std::vector<char> readFile(const std::string& filepath) {
-    std::ifstream file{ filepath, std::ios::ate | std::ios::binary };
+static void printArenaStats(const MemoryArena& arena) {
+    ArenaStats stats = arena.getStats();
+    std::cout << "Memory arena: " << stats.allocationCount << " allocations in " << stats.blockCount << " blocks" << std::endl;
+    std::cout << "    Used: " << stats.bytesUsed << " / " << stats.bytesReserved << " bytes reserved" << std::endl;
+    std::cout << "    Largest free range: " << stats.largestFreeRange << " bytes, fragmentation " <<
+        stats.fragmentation * 100.0 << "%" << std::endl;
+}
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + filepath);
+// Compares GPU output with the CPU kernel element by element and reports the
+// first few mismatches; returns the number of mismatching elements
+static size_t verifyOutput(const CpuKernel& cpuKernel, const std::vector<uint32_t>& input,
+    const std::vector<uint32_t>& output, std::vector<uint32_t>& expected) {
+    cpuKernel.run(input, expected);
+    if (output.size() != expected.size()) {
+        std::cout << "Verification failed: " << output.size() << " elements returned, " << expected.size() << " expected" << std::endl;
+        return expected.size();
     }
 
-    size_t fileSize = static_cast<size_t>(file.tellg());
-    std::vector<char> buffer(fileSize);
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-    file.close();
+    const size_t maxReported = 10;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (output[i] != expected[i]) {
+            if (mismatches < maxReported) {
+                std::cout << "    Mismatch at " << i << ": input " << input[i] << ", GPU " << output[i] <<
+                    ", CPU " << expected[i] << std::endl;
+            }
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
 
-    return buffer;
+static void writeProfile(const Profiler& profiler, const std::string& filepath) {
+    if (filepath.empty()) {
+        return;
+    }
+    profiler.writeFile(filepath);
+    std::cout << "Profile written to " << filepath << std::endl;
 }
 
-int main() {
+// Runs every primitive over random data against its standard library
+// equivalent and prints GPU time and throughput per check; returns the number
+// of failed checks. Float sums are compared with a tolerance relative to the
+// sum of magnitudes, since the GPU adds in a different order.
+static size_t checkPrimitives(ParallelPrimitives& primitives, uint32_t elements, Profiler& profiler) {
+    std::mt19937 random(12345);
+    std::uniform_int_distribution<uint32_t> uintDistribution;
+    std::uniform_real_distribution<float> floatDistribution(-1.0f, 1.0f);
+    std::vector<uint32_t> uintData(elements);
+    std::vector<float> floatData(elements);
+    for (uint32_t i = 0; i < elements; ++i) {
+        uintData[i] = uintDistribution(random);
+        floatData[i] = floatDistribution(random);
+    }
 
-    // Create vulkan instance
-    VkApplicationInfo applicationInfo = {};
-    applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    applicationInfo.pNext = nullptr;
-    applicationInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-    applicationInfo.pEngineName = nullptr;
-    applicationInfo.engineVersion = VK_MAKE_VERSION(0, 0, 0);
-    applicationInfo.apiVersion = VK_API_VERSION_1_0;
+    size_t failures = 0;
+    auto report = [&](const std::string& name, bool passed) {
+        const bool gpuTime = primitives.hasGpuTimestamps();
+        const double milliseconds = gpuTime ? primitives.getLastGpuMilliseconds() : primitives.getLastSubmitMilliseconds();
+        profiler.record(name, milliseconds, gpuTime ? PhaseClock::Gpu : PhaseClock::Host);
+        std::cout << "    " << name << ": " << milliseconds << " ms, " <<
+            (milliseconds > 0.0 ? elements / milliseconds / 1000.0 : 0.0) << " M elements/s, " <<
+            primitives.getLastDispatchCount() << " dispatches, " << (passed ? "passed" : "FAILED") << std::endl;
+        failures += passed ? 0 : 1;
+    };
+
+    for (PrimitiveOp op : { PrimitiveOp::Add, PrimitiveOp::Min, PrimitiveOp::Max }) {
+        const std::string opName = primitiveOpName(op);
+        auto combineUint = [op](uint32_t a, uint32_t b) {
+            return op == PrimitiveOp::Add ? a + b : op == PrimitiveOp::Min ? std::min(a, b) : std::max(a, b);
+        };
+        auto combineFloat = [op](double a, double b) {
+            return op == PrimitiveOp::Add ? a + b : op == PrimitiveOp::Min ? std::min(a, b) : std::max(a, b);
+        };
+        const uint32_t uintIdentity = op == PrimitiveOp::Min ? UINT32_MAX : 0u;
+        const double floatIdentity = op == PrimitiveOp::Add ? 0.0 :
+            op == PrimitiveOp::Min ? std::numeric_limits<double>::infinity() : -std::numeric_limits<double>::infinity();
+        // Min and max are exact; sums are checked against the magnitudes added so far
+        auto floatMatches = [op](float value, double expected, double magnitude) {
+            return op == PrimitiveOp::Add ? std::abs(value - expected) <= 1e-5 * magnitude + 1e-6 : value == expected;
+        };
+
+        const uint32_t uintReduced = primitives.reduce(uintData, op);
+        report("reduce_" + opName + "_u32", uintReduced == std::accumulate(uintData.begin(), uintData.end(), uintIdentity, combineUint));
+
+        double magnitude = 0.0;
+        for (float value : floatData) {
+            magnitude += std::abs(value);
+        }
+        const float floatReduced = primitives.reduce(floatData, op);
+        report("reduce_" + opName + "_f32", floatMatches(floatReduced,
+            std::accumulate(floatData.begin(), floatData.end(), floatIdentity, combineFloat), magnitude));
+
+        std::vector<uint32_t> expectedUint(elements);
+        std::partial_sum(uintData.begin(), uintData.end(), expectedUint.begin(), combineUint);
+        std::vector<uint32_t> uintScanned;
+        primitives.scan(uintData, uintScanned, op, true);
+        report("scan_inclusive_" + opName + "_u32", uintScanned == expectedUint);
+
+        expectedUint.insert(expectedUint.begin(), uintIdentity);
+        expectedUint.pop_back();
+        primitives.scan(uintData, uintScanned, op, false);
+        report("scan_exclusive_" + opName + "_u32", uintScanned == expectedUint);
+
+        std::vector<float> floatScanned;
+        primitives.scan(floatData, floatScanned, op, true);
+        bool floatScanPassed = floatScanned.size() == elements;
+        double running = floatIdentity;
+        magnitude = 0.0;
+        for (uint32_t i = 0; i < elements && floatScanPassed; ++i) {
+            running = combineFloat(running, floatData[i]);
+            magnitude += std::abs(floatData[i]);
+            floatScanPassed = floatMatches(floatScanned[i], running, magnitude);
+        }
+        report("scan_inclusive_" + opName + "_f32", floatScanPassed);
+    }
 
-    const char* validationLayer = "VK_LAYER_KHRONOS_validation" ;
+    // Values carry each key's input position, which makes the order of equal
+    // keys, and so the stability of the sort, part of the comparison
+    std::vector<uint32_t> order(elements);
+    std::iota(order.begin(), order.end(), 0u);
+
+    std::vector<uint32_t> uintKeys = uintData;
+    std::vector<uint32_t> uintValues = order;
+    primitives.sort(uintKeys, &uintValues);
+    std::vector<uint32_t> expectedOrder = order;
+    std::stable_sort(expectedOrder.begin(), expectedOrder.end(), [&](uint32_t a, uint32_t b) {
+        return uintData[a] < uintData[b];
+    });
+    report("sort_u32", uintValues == expectedOrder && std::is_sorted(uintKeys.begin(), uintKeys.end()));
+
+    std::vector<float> floatKeys = floatData;
+    std::vector<uint32_t> floatValues = order;
+    primitives.sort(floatKeys, &floatValues);
+    expectedOrder = order;
+    std::stable_sort(expectedOrder.begin(), expectedOrder.end(), [&](uint32_t a, uint32_t b) {
+        return floatData[a] < floatData[b];
+    });
+    report("sort_f32", floatValues == expectedOrder && std::is_sorted(floatKeys.begin(), floatKeys.end()));
+
+    return failures;
+}
 
-    VkInstanceCreateInfo instanceCreateInfo = {};
-    instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    instanceCreateInfo.pNext = nullptr;
-    instanceCreateInfo.pApplicationInfo = &applicationInfo;
-    instanceCreateInfo.enabledLayerCount = 1;
-    instanceCreateInfo.ppEnabledLayerNames = &validationLayer;
+int main(int argc, char* argv[]) {
+    uint32_t elements = 10;
+    uint32_t jobCount = 1;
+    MemoryMode memoryMode = MemoryMode::Auto;
+    ComputeContextOptions contextOptions;
+    uint32_t workgroupSize = 0;
+    bool tune = false;
+    uint32_t tuneElements = 1 << 20;
+    std::string streamInputPath;
+    std::string streamOutputPath;
+    StreamOptions streamOptions;
+    std::string profilePath;
+    bool benchmark = false;
+    BenchmarkOptions benchmarkOptions;
+    std::string benchmarkOutputPath;
+    bool verify = false;
+    bool cpuOffload = true;
+    uint32_t cpuOffloadThreshold = 0;
+    uint32_t cpuThreads = 0;
+    bool async = false;
+    uint32_t maxInFlight = 4;
+    std::vector<int> partitionDevices;
+    bool partitionAllDevices = false;
+    uint32_t scale = 1;
+    bool submitCost = false;
+    uint32_t graphPasses = 0;
+    std::string kernelsPath;
+    std::string mapInputPath;
+    std::string mapOutputPath;
+    MappedFileOptions mappedFileOptions;
+    uint32_t batchThreads = 0;
+    MicroBatchOptions microBatchOptions;
+    uint32_t primitiveElements = 0;
+    bool allowSubgroups = true;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--elements" && i + 1 < argc) {
+            elements = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--jobs" && i + 1 < argc) {
+            jobCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--memory" && i + 1 < argc) {
+            if (!parseMemoryMode(argv[++i], memoryMode)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--no-transfer-queue") {
+            contextOptions.enableTransferQueue = false;
+        }
+        else if (arg == "--pipeline-cache" && i + 1 < argc) {
+            contextOptions.pipelineCacheDirectory = argv[++i];
+        }
+        else if (arg == "--no-pipeline-cache") {
+            contextOptions.pipelineCacheDirectory.clear();
+        }
+        else if (arg == "--workgroup-size" && i + 1 < argc) {
+            workgroupSize = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--tune") {
+            tune = true;
+        }
+        else if (arg == "--tune-elements" && i + 1 < argc) {
+            tuneElements = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--stream" && i + 2 < argc) {
+            streamInputPath = argv[++i];
+            streamOutputPath = argv[++i];
+        }
+        else if (arg == "--chunk-elements" && i + 1 < argc) {
+            streamOptions.chunkElements = static_cast<uint32_t>(std::stoul(argv[++i]));
+            mappedFileOptions.chunkElements = streamOptions.chunkElements;
+        }
+        else if (arg == "--slots" && i + 1 < argc) {
+            streamOptions.slotCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        }
+        else if (arg == "--no-validation") {
+            contextOptions.enableValidation = false;
+        }
+        else if (arg == "--benchmark") {
+            benchmark = true;
+        }
+        else if (arg == "--bench-sizes" && i + 1 < argc) {
+            for (const std::string& size : splitList(argv[++i])) {
+                benchmarkOptions.sizes.push_back(Benchmark::parseSize(size));
+            }
+        }
+        else if (arg == "--bench-workgroup-sizes" && i + 1 < argc) {
+            for (const std::string& size : splitList(argv[++i])) {
+                benchmarkOptions.workgroupSizes.push_back(static_cast<uint32_t>(std::stoul(size)));
+            }
+        }
+        else if (arg == "--bench-memory" && i + 1 < argc) {
+            for (const std::string& name : splitList(argv[++i])) {
+                MemoryMode mode;
+                if (!parseMemoryMode(name, mode) || mode == MemoryMode::Auto) {
+                    printUsage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                benchmarkOptions.memoryModes.push_back(mode);
+            }
+        }
+        else if (arg == "--bench-warmup" && i + 1 < argc) {
+            benchmarkOptions.warmupIterations = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--bench-iterations" && i + 1 < argc) {
+            benchmarkOptions.iterations = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--bench-output" && i + 1 < argc) {
+            benchmarkOutputPath = argv[++i];
+        }
+        else if (arg == "--verify") {
+            verify = true;
+        }
+        else if (arg == "--no-cpu-offload") {
+            cpuOffload = false;
+        }
+        else if (arg == "--cpu-offload-threshold" && i + 1 < argc) {
+            cpuOffloadThreshold = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--cpu-threads" && i + 1 < argc) {
+            cpuThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--async") {
+            async = true;
+        }
+        else if (arg == "--in-flight" && i + 1 < argc) {
+            maxInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--device" && i + 1 < argc) {
+            contextOptions.deviceIndex = std::stoi(argv[++i]);
+        }
+        else if (arg == "--devices" && i + 1 < argc) {
+            const std::string list = argv[++i];
+            partitionAllDevices = list == "all";
+            for (const std::string& device : partitionAllDevices ? std::vector<std::string>() : splitList(list)) {
+                partitionDevices.push_back(std::stoi(device));
+            }
+        }
+        else if (arg == "--queues" && i + 1 < argc) {
+            contextOptions.computeQueueCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--scale" && i + 1 < argc) {
+            scale = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--submit-cost") {
+            submitCost = true;
+        }
+        else if (arg == "--graph" && i + 1 < argc) {
+            graphPasses = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--kernels" && i + 1 < argc) {
+            kernelsPath = argv[++i];
+        }
+        else if (arg == "--map" && i + 2 < argc) {
+            mapInputPath = argv[++i];
+            mapOutputPath = argv[++i];
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batchThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--batch-elements" && i + 1 < argc) {
+            microBatchOptions.maxBatchElements = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--batch-wait" && i + 1 < argc) {
+            microBatchOptions.maxWaitMicroseconds = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--primitives" && i + 1 < argc) {
+            primitiveElements = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--no-subgroups") {
+            allowSubgroups = false;
+        }
+        else if (arg == "--no-host-import") {
+            mappedFileOptions.allowImport = false;
+        }
+        else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-    VkInstance instance;
-    if (vkCreateInstance(&instanceCreateInfo, nullptr, &instance) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create instance");
+    // When results are streamed to stdout, everything else printed through
+    // std::cout goes to stderr so it cannot corrupt the binary output
+    std::ostream streamStdout(std::cout.rdbuf());
+    if (streamOutputPath == "-") {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+#ifdef _WIN32
+    if (streamInputPath == "-") {
+        _setmode(_fileno(stdin), _O_BINARY);
+    }
+    if (streamOutputPath == "-") {
+        _setmode(_fileno(stdout), _O_BINARY);
     }
+#endif
 
-    // Get physical device info
-    uint32_t deviceCount = 0;
-    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-    if (deviceCount == 0) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to find physical device");
+    using Clock = std::chrono::steady_clock;
+
+    Profiler profiler;
+    contextOptions.profiler = &profiler;
+    if (benchmark) {
+        // Validation adds per-call overhead that would skew small-job timings
+        contextOptions.enableValidation = false;
+    }
+
+    // The main context always covers the first device of a partitioned run
+    const bool partition = partitionAllDevices || !partitionDevices.empty() || contextOptions.computeQueueCount > 1;
+    if (partitionAllDevices) {
+        contextOptions.deviceIndex = 0;
     }
-    std::cout << "Physical device count: " << deviceCount << std::endl << std::endl;
-    std::vector<VkPhysicalDevice> physicalDeviceList(deviceCount);
-    vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDeviceList.data());
+    else if (!partitionDevices.empty()) {
+        contextOptions.deviceIndex = partitionDevices[0];
+    }
+
+    // Instance, device and pipeline setup is paid once for all jobs
+    auto setupStart = Clock::now();
+    ComputeContext context(contextOptions);
 
-    VkPhysicalDeviceProperties deviceProperties;
-    VkPhysicalDevice physicalDevice;
+    std::string shaderPath = "compute_shader.comp.spv";
 
-    int deviceNumber = 0;
-    std::cout << "Available devices: " << std::endl;
-    for (const auto& device : physicalDeviceList) {
-        vkGetPhysicalDeviceProperties(device, &deviceProperties);
-        std::cout << "   Device(" << deviceNumber << "): " << deviceProperties.deviceName << std::endl;
+    // The kernel borrows its pipeline and layouts from the registry, so the
+    // registry is declared first and destroyed last
+    std::unique_ptr<KernelRegistry> registry;
+    if (!kernelsPath.empty()) {
+        registry = std::make_unique<KernelRegistry>(context, workgroupSize);
+        registry->addPath(kernelsPath);
+        if (registry->contains("compute_shader.comp")) {
+            shaderPath = registry->getPath("compute_shader.comp");
+        }
     }
 
-    int selectedDevice = -1;
-    if (deviceCount > 1) {
-        std::cout << std::endl;
-        while (selectedDevice < 0 || selectedDevice >= deviceCount) {
-            std::cout << ">> Select device (0-" << deviceCount - 1 << "): ";
-            std::cin >> selectedDevice;
-            if (!std::cin.good()) {
-                std::cin.clear();
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                std::cout << "Must enter valid number" << std::endl;
-                selectedDevice = -1;
+    if (benchmark) {
+        Benchmark bench(context, shaderPath, benchmarkOptions);
+        bench.run();
+        bench.printSummary(std::cout);
+        if (!benchmarkOutputPath.empty()) {
+            bench.writeFile(benchmarkOutputPath);
+            std::cout << "Benchmark results written to " << benchmarkOutputPath << std::endl;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (primitiveElements > 0) {
+        size_t failures = 0;
+        {
+            ParallelPrimitives primitives(context, workgroupSize, allowSubgroups);
+            std::cout << "Parallel primitives: " << primitiveElements << " elements, workgroup size " <<
+                primitives.getWorkgroupSize() << " (sort " << primitives.getSortWorkgroupSize() << "), ";
+            if (primitives.usesSubgroups()) {
+                std::cout << "subgroup arithmetic (subgroup size " << context.getSubgroupSize() << ")" << std::endl;
             }
-            else if (selectedDevice < 0 || selectedDevice >= deviceCount) {
-                std::cout << "Must enter valid number" << std::endl;
+            else {
+                std::cout << "shared memory only" << (allowSubgroups ? "" : " (--no-subgroups)") << std::endl;
             }
+            std::cout << "    Times are " << (primitives.hasGpuTimestamps() ? "GPU timestamps around the passes" :
+                "submit to fence on the host (no timestamp support)") << std::endl;
+            failures = checkPrimitives(primitives, primitiveElements, profiler);
         }
+        std::cout << "Verification: " << (failures == 0 ? "passed" : "FAILED") << " (" << failures <<
+            " failed checks)" << std::endl << std::endl;
+
+        printArenaStats(context.getMemoryArena());
+        writeProfile(profiler, profilePath);
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    WorkgroupTuner tuner("workgroup_sizes.txt");
+    std::string workgroupSizeSource = "requested";
+    if (workgroupSize == 0) {
+        workgroupSizeSource = tuner.lookup(context, shaderPath, workgroupSize) ? "tuned" : "default";
+    }
+
+    // From the registry only compute_shader.comp's module and pipeline are
+    // loaded: lazy startup pays for the kernel that is actually used
+    std::unique_ptr<ComputeKernel> kernelOwner;
+    if (registry && registry->contains("compute_shader.comp")) {
+        ScopedPhase phase(&profiler, "kernel_registry_lazy");
+        kernelOwner = std::make_unique<ComputeKernel>(context, *registry, "compute_shader.comp", memoryMode, workgroupSize);
     }
     else {
-        selectedDevice = 0;
+        kernelOwner = std::make_unique<ComputeKernel>(context, shaderPath, memoryMode, workgroupSize);
+    }
+    ComputeKernel& kernel = *kernelOwner;
+    kernel.setScale(scale);
+    auto setupEnd = Clock::now();
+    const double setupMilliseconds = std::chrono::duration<double, std::milli>(setupEnd - setupStart).count();
+    const double pipelineCreationMilliseconds = kernel.getPipelineCreationMilliseconds();
+    profiler.record("startup", setupMilliseconds);
+
+    if (tune) {
+        ScopedPhase phase(&profiler, "tune");
+        tuner.tune(context, kernel, shaderPath, std::max(tuneElements, 1u), 20);
+        workgroupSizeSource = "tuned now";
     }
-    std::cout << std::endl;
 
-    physicalDevice = physicalDeviceList[selectedDevice];
-    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::cout << "Startup: " << setupMilliseconds << " ms" << std::endl;
+    std::cout << "    Pipeline creation: " << pipelineCreationMilliseconds << " ms (" <<
+        (context.isPipelineCacheWarm() ? "warm" : "cold") << " pipeline cache";
+    if (context.isPipelineCacheWarm()) {
+        std::cout << ", " << context.getPipelineCacheLoadedBytes() << " bytes loaded";
+    }
+    std::cout << ")" << std::endl;
+    std::cout << "    Workgroup size: " << kernel.getWorkgroupSize() << " (" << workgroupSizeSource << ")" << std::endl << std::endl;
+
+    if (registry) {
+        // Both strategies are timed until compute_shader.comp's pipeline is
+        // ready: lazy loads only that kernel, eager loads every kernel up front
+        // on the thread pool. Each runs on a fresh registry that bypasses the
+        // pipeline cache, so neither reuses what the other, or the kernel
+        // above, has compiled.
+        ThreadPool registryThreadPool(cpuThreads);
+        RegistryStats lazyStats;
+        RegistryStats eagerStats;
+        if (registry->contains("compute_shader.comp")) {
+            ScopedPhase phase(&profiler, "kernel_registry_lazy_uncached");
+            KernelRegistry lazyRegistry(context, workgroupSize, false);
+            lazyRegistry.addPath(kernelsPath);
+            lazyRegistry.getPipeline("compute_shader.comp");
+            lazyStats = lazyRegistry.getStats();
+        }
+        {
+            ScopedPhase phase(&profiler, "kernel_registry_eager_uncached");
+            KernelRegistry eagerRegistry(context, workgroupSize, false);
+            eagerRegistry.addPath(kernelsPath);
+            eagerRegistry.createAll(&registryThreadPool);
+            eagerStats = eagerRegistry.getStats();
+        }
 
-    if (physicalDevice == VK_NULL_HANDLE) {
-        throw std::runtime_error("RUNTIME ERROR: Invalid device (VK_NULL_HANDLE)");
+        std::cout << "Kernel registry: " << eagerStats.kernelCount << " kernels, " << eagerStats.moduleCount <<
+            " distinct shader modules, " << eagerStats.skippedCount << " skipped (different interface)" << std::endl;
+        std::cout << "    Lazy:  " << lazyStats.loadMilliseconds + lazyStats.pipelineMilliseconds << " ms (" <<
+            lazyStats.pipelineCount << " pipeline" << (registry->contains("compute_shader.comp") ? ", compute_shader.comp" : "") <<
+            ")" << std::endl;
+        std::cout << "    Eager: " << eagerStats.loadMilliseconds + eagerStats.pipelineMilliseconds << " ms (" <<
+            eagerStats.pipelineCount << " pipelines on " << registryThreadPool.getConcurrency() << " threads; load " <<
+            eagerStats.loadMilliseconds << " ms, pipelines " << eagerStats.pipelineMilliseconds << " ms)" << std::endl;
+        std::cout << "    Both without the pipeline cache; driver-internal shader caches still apply" << std::endl << std::endl;
     }
 
-    // Print physical device info
-    std::cout << deviceProperties.deviceName << " (Device "<< selectedDevice <<") selected." << std::endl;
-    std::cout << "    Vulkan version: " << VK_VERSION_MAJOR(deviceProperties.apiVersion) <<
-        "." << VK_VERSION_MINOR(deviceProperties.apiVersion) <<
-        "." << VK_VERSION_PATCH(deviceProperties.apiVersion) << std::endl;
-    std::cout << "    Max compute shared memory size: " << deviceProperties.limits.maxComputeSharedMemorySize / 1024 << "KB" << std::endl << std::endl;
+    if (!mapInputPath.empty()) {
+        MappedFileRunner mappedFileRunner(context, kernel, mappedFileOptions);
+        MappedFileStats stats;
+        {
+            ScopedPhase phase(&profiler, "mapped_file");
+            stats = mappedFileRunner.run(mapInputPath, mapOutputPath);
+        }
+
+        std::cout << "Mapped files: input " << (stats.inputImported ? "imported" : "copied") << ", output " <<
+            (stats.outputImported ? "imported" : "copied") << std::endl;
+        std::cout << "    " << stats.elements << " elements in " << stats.jobs << " jobs of up to " <<
+            mappedFileRunner.getChunkElements() << " elements" << std::endl;
+        std::cout << "    " << stats.bytesCopied << " bytes copied by the host (" <<
+            (stats.jobs > 0 ? stats.bytesCopied / stats.jobs : 0) << " per job)" << std::endl;
+        std::cout << "    " << stats.seconds * 1000.0 << " ms, " << stats.gigabytesPerSecond << " GB/s (read + write)" <<
+            std::endl << std::endl;
+
+        writeProfile(profiler, profilePath);
+        return EXIT_SUCCESS;
+    }
 
-    // Get compute queue index
-    uint32_t queueFamilyPropCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropCount, nullptr);
+    if (!streamInputPath.empty()) {
+        std::ifstream inputFile;
+        std::ofstream outputFile;
+        if (streamInputPath != "-") {
+            inputFile.open(streamInputPath, std::ios::binary);
+            if (!inputFile) {
+                std::cerr << "Failed to open " << streamInputPath << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        if (streamOutputPath != "-") {
+            outputFile.open(streamOutputPath, std::ios::binary | std::ios::trunc);
+            if (!outputFile) {
+                std::cerr << "Failed to open " << streamOutputPath << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        std::istream& streamInput = streamInputPath == "-" ? std::cin : inputFile;
+        std::ostream& streamOutput = streamOutputPath == "-" ? streamStdout : outputFile;
 
-    std::cout << "Queue family prop count: " << queueFamilyPropCount << std::endl;
-    std::vector<VkQueueFamilyProperties> queueFamilyPropVec(queueFamilyPropCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropCount, queueFamilyPropVec.data());
+        StreamRunner streamRunner(context, kernel, streamOptions);
+        std::cout << "Streaming: " << streamRunner.getChunkElements() << " elements per chunk, " <<
+            streamRunner.getSlotCount() << " chunks in flight" << std::endl;
 
-    uint32_t computeQueueIndex = 0;
-    for (const auto& prop : queueFamilyPropVec) {
-        if (prop.queueCount > 0 && prop.queueFlags & VK_QUEUE_COMPUTE_BIT) {
-            break;
+        StreamStats stats;
+        {
+            ScopedPhase phase(&profiler, "stream");
+            stats = streamRunner.run(streamInput, streamOutput);
         }
-        ++computeQueueIndex;
+
+        std::cout << "    " << stats.elements << " elements in " << stats.chunks << " chunks, " <<
+            stats.bytesRead << " bytes read, " << stats.bytesWritten << " bytes written" << std::endl;
+        std::cout << "    " << stats.seconds * 1000.0 << " ms, sustained " << stats.gigabytesPerSecond <<
+            " GB/s (read + write)" << std::endl << std::endl;
+
+        printArenaStats(context.getMemoryArena());
+        writeProfile(profiler, profilePath);
+
+        return EXIT_SUCCESS;
     }
 
-    std::cout << "Compute queue family index: " << computeQueueIndex << std::endl << std::endl;
+    ThreadPool threadPool(cpuThreads);
+    CpuKernel cpuKernel(&threadPool);
+    cpuKernel.setScale(scale);
+    std::cout << "CPU kernel: " << simdLevelName(cpuKernel.getSimdLevel()) << ", " << cpuKernel.getThreadCount() <<
+        " threads" << std::endl;
 
-    // Create vulkan device
-    VkDevice vulkanDevice = {};
-    std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfoVec;
+    std::vector<uint32_t> dataVec(elements);
+    for (uint32_t i = 0; i < elements; ++i) {
+        dataVec[i] = i;
+    }
+    std::vector<uint32_t> dataOutVec;
+    std::vector<uint32_t> expectedVec;
+
+    if (submitCost) {
+        // The same job over and over, first re-recording the command buffers
+        // every time and then resubmitting the ones recorded for the first job
+        const uint32_t runs = std::max(jobCount, 10u);
+        std::cout << "Host submit cost (" << runs << " jobs x " << elements << " elements):" << std::endl;
+        for (bool reuse : { false, true }) {
+            kernel.setCommandBufferReuse(reuse);
+            kernel.run(dataVec, dataOutVec);
+
+            const uint32_t recordsBefore = kernel.getRecordCount();
+            std::vector<double> submitMicroseconds(runs);
+            for (double& submitTime : submitMicroseconds) {
+                kernel.run(dataVec, dataOutVec);
+                submitTime = kernel.getLastSubmitMicroseconds();
+                profiler.record(reuse ? "submit_reused" : "submit_rerecorded", submitTime / 1000.0);
+            }
+            std::sort(submitMicroseconds.begin(), submitMicroseconds.end());
 
-    float queuePriority = 1.0f;
-    VkDeviceQueueCreateInfo deviceQueueCreateInfo = {};
-    deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    deviceQueueCreateInfo.queueFamilyIndex = computeQueueIndex;
-    deviceQueueCreateInfo.queueCount = 1;
-    deviceQueueCreateInfo.pQueuePriorities = &queuePriority;
-    deviceQueueCreateInfoVec.push_back(deviceQueueCreateInfo);
+            std::cout << "    " << (reuse ? "Reused:      " : "Re-recorded: ") << "median " <<
+                submitMicroseconds[runs / 2] << " us, min " << submitMicroseconds.front() << " us, max " <<
+                submitMicroseconds.back() << " us (" << kernel.getRecordCount() - recordsBefore << " recordings)" << std::endl;
+        }
+        std::cout << std::endl;
 
-    VkDeviceCreateInfo deviceCreateInfo = {};
-    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfoVec.data();
-    deviceCreateInfo.enabledLayerCount = 0;
+        if (verify) {
+            const size_t mismatches = verifyOutput(cpuKernel, dataVec, dataOutVec, expectedVec);
+            std::cout << "Verification: " << (mismatches == 0 ? "passed" : "FAILED") << " (" << mismatches <<
+                " mismatches in " << elements << " elements)" << std::endl << std::endl;
+            if (mismatches > 0) {
+                return EXIT_FAILURE;
+            }
+        }
 
-    if (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &vulkanDevice) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create vulkan device");
+        writeProfile(profiler, profilePath);
+        return EXIT_SUCCESS;
     }
 
-    // Create input/output buffers
-    const uint32_t elements = 10;
-    const uint32_t bufferSize = elements * sizeof(uint32_t);
+    if (graphPasses > 0) {
+        // input -> t0 -> t1 -> ... -> output, each pass squaring and scaling
+        // the previous result; t(i) and t(i + 2) never live at the same time
+        ComputeGraph graph(context, kernel.getWorkgroupSize());
+        const GraphBufferId input = graph.addBuffer("input", GraphBufferKind::Input, elements);
+        const GraphBufferId output = graph.addBuffer("output", GraphBufferKind::Output, elements);
+
+        KernelParameters parameters;
+        parameters.count = elements;
+        parameters.scale = scale;
+
+        GraphBufferId previous = input;
+        for (uint32_t pass = 0; pass < graphPasses; ++pass) {
+            const GraphBufferId next = pass + 1 == graphPasses ? output :
+                graph.addBuffer("t" + std::to_string(pass), GraphBufferKind::Transient, elements);
+            graph.addPass("pass" + std::to_string(pass), shaderPath, { { 0, previous, false }, { 1, next, true } }, parameters);
+            previous = next;
+        }
+        graph.compile();
+
+        memcpy(graph.getMappedData(input), dataVec.data(), elements * sizeof(uint32_t));
+        std::vector<double> graphMilliseconds(std::max(jobCount, 1u));
+        for (double& graphTime : graphMilliseconds) {
+            auto graphStart = Clock::now();
+            graph.run();
+            graphTime = std::chrono::duration<double, std::milli>(Clock::now() - graphStart).count();
+            profiler.record("graph_run", graphTime);
+        }
+        std::sort(graphMilliseconds.begin(), graphMilliseconds.end());
+
+        const uint32_t* graphOutput = static_cast<const uint32_t*>(graph.getMappedData(output));
+        dataOutVec.assign(graphOutput, graphOutput + elements);
 
-    VkBufferCreateInfo bufferCreateInfo = {};
-    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.pNext = nullptr;
-    bufferCreateInfo.size = bufferSize;
-    bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    bufferCreateInfo.queueFamilyIndexCount = 1;
-    bufferCreateInfo.pQueueFamilyIndices = &computeQueueIndex;
+        std::cout << "Graph: " << graphPasses << " passes, " << graph.getBarrierCount() << " barriers, transients " <<
+            graph.getTransientBytes() << " bytes aliased (" << graph.getUnaliasedTransientBytes() << " bytes unaliased)" << std::endl;
+        std::cout << "    median " << graphMilliseconds[graphMilliseconds.size() / 2] << " ms per submit" << std::endl;
 
-    VkBuffer inBuffer;
-    VkBuffer outBuffer;
+        // Applying the CPU kernel once per pass gives the expected result
+        expectedVec = dataVec;
+        for (uint32_t pass = 0; pass < graphPasses; ++pass) {
+            std::vector<uint32_t> passOutput;
+            cpuKernel.run(expectedVec, passOutput);
+            expectedVec.swap(passOutput);
+        }
+        size_t mismatches = 0;
+        for (uint32_t i = 0; i < elements; ++i) {
+            mismatches += dataOutVec[i] != expectedVec[i] ? 1 : 0;
+        }
+        std::cout << "Verification: " << (mismatches == 0 ? "passed" : "FAILED") << " (" << mismatches <<
+            " mismatches in " << elements << " elements)" << std::endl << std::endl;
 
-    if (vkCreateBuffer(vulkanDevice, &bufferCreateInfo, nullptr, &inBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create input buffer");
+        writeProfile(profiler, profilePath);
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    if (vkCreateBuffer(vulkanDevice, &bufferCreateInfo, nullptr, &outBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create output buffer");
+
+    if (batchThreads > 0) {
+        // Baseline: the same number of requests, one submit each
+        const uint32_t requestsPerThread = std::max(jobCount, 1u);
+        const uint32_t requestCount = batchThreads * requestsPerThread;
+        auto unbatchedStart = Clock::now();
+        for (uint32_t request = 0; request < requestCount; ++request) {
+            kernel.run(dataVec, dataOutVec);
+        }
+        const double unbatchedSeconds = std::chrono::duration<double>(Clock::now() - unbatchedStart).count();
+
+        // Every thread waits for each result before sending its next request,
+        // like a client would, and checks it against the CPU kernel. Inputs
+        // differ per request so a result scattered to the wrong caller shows.
+        CpuKernel requestCpuKernel;
+        requestCpuKernel.setScale(scale);
+        std::vector<size_t> threadMismatches(batchThreads);
+        MicroBatchStats stats;
+        double batchedSeconds = 0.0;
+        {
+            MicroBatcher batcher(context, kernel, microBatchOptions);
+            std::cout << "Micro-batching: up to " << batcher.getMaxBatchElements() << " elements or " <<
+                batcher.getMaxWaitMicroseconds() << " us per batch, " << batchThreads << " threads" << std::endl;
+
+            ScopedPhase phase(&profiler, "micro_batching");
+            auto batchedStart = Clock::now();
+            std::vector<std::thread> threads;
+            for (uint32_t thread = 0; thread < batchThreads; ++thread) {
+                threads.emplace_back([&, thread]() {
+                    std::vector<uint32_t> requestInput(elements);
+                    std::vector<uint32_t> requestExpected;
+                    for (uint32_t request = 0; request < requestsPerThread; ++request) {
+                        for (uint32_t i = 0; i < elements; ++i) {
+                            requestInput[i] = (thread * requestsPerThread + request) + i;
+                        }
+                        const std::vector<uint32_t> requestOutput = batcher.enqueue(requestInput).get();
+                        requestCpuKernel.run(requestInput, requestExpected);
+                        threadMismatches[thread] += requestOutput == requestExpected ? 0 : 1;
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            batchedSeconds = std::chrono::duration<double>(Clock::now() - batchedStart).count();
+            stats = batcher.getStats();
+        }
+
+        size_t mismatches = 0;
+        for (size_t threadMismatch : threadMismatches) {
+            mismatches += threadMismatch;
+        }
+
+        std::cout << "    " << stats.requests << " requests x " << elements << " elements in " << stats.batches << " batches (" <<
+            (stats.batches > 0 ? static_cast<double>(stats.requests) / stats.batches : 0.0) << " requests per batch)" << std::endl;
+        std::cout << "    Latency: p50 " << stats.latencyP50Microseconds << " us, p90 " << stats.latencyP90Microseconds <<
+            " us, p99 " << stats.latencyP99Microseconds << " us, max " << stats.latencyMaxMicroseconds << " us" << std::endl;
+        if (batchedSeconds > 0.0 && unbatchedSeconds > 0.0) {
+            std::cout << "    Batched:   " << requestCount / batchedSeconds << " requests/s, " <<
+                stats.elements / batchedSeconds / 1e6 << " M elements/s" << std::endl;
+            std::cout << "    Unbatched: " << requestCount / unbatchedSeconds << " requests/s (one submit per request, one thread)" <<
+                std::endl;
+        }
+        std::cout << "Verification: " << (mismatches == 0 ? "passed" : "FAILED") << " (" << mismatches <<
+            " mismatching requests)" << std::endl << std::endl;
+
+        printArenaStats(context.getMemoryArena());
+        writeProfile(profiler, profilePath);
+
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    // Allocate input/output buffer memory
-    VkMemoryRequirements inBufferMemoryReq;
-    VkMemoryRequirements outBufferMemoryReq;
-    vkGetBufferMemoryRequirements(vulkanDevice, inBuffer, &inBufferMemoryReq);
-    vkGetBufferMemoryRequirements(vulkanDevice, inBuffer, &outBufferMemoryReq);
+    if (async) {
+        AsyncCompute asyncCompute(context, kernel, maxInFlight);
+        std::cout << "Async: " << asyncCompute.getMaxInFlight() << " jobs in flight, completion via " <<
+            (asyncCompute.usesTimelineSemaphore() ? "timeline semaphore" : "fences") << std::endl;
+
+        // Keep a few more futures than slots so submit() is what blocks, and
+        // the queue never runs dry while this thread checks results
+        std::deque<std::future<std::vector<uint32_t>>> pending;
+        size_t mismatches = 0;
+        auto asyncStart = Clock::now();
+        {
+            ScopedPhase phase(&profiler, "async_jobs");
+            auto retireOldest = [&]() {
+                dataOutVec = pending.front().get();
+                pending.pop_front();
+                if (verify) {
+                    mismatches += verifyOutput(cpuKernel, dataVec, dataOutVec, expectedVec);
+                }
+            };
+            for (uint32_t job = 0; job < jobCount; ++job) {
+                pending.push_back(asyncCompute.submit(dataVec));
+                if (pending.size() > 2 * asyncCompute.getMaxInFlight()) {
+                    retireOldest();
+                }
+            }
+            while (!pending.empty()) {
+                retireOldest();
+            }
+        }
+        const double asyncSeconds = std::chrono::duration<double>(Clock::now() - asyncStart).count();
+        const double bytes = 2.0 * jobCount * elements * sizeof(uint32_t);
 
-    VkPhysicalDeviceMemoryProperties physicalDeviceMemProps;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &physicalDeviceMemProps);
+        std::cout << "    " << jobCount << " jobs x " << elements << " elements in " << asyncSeconds * 1000.0 << " ms" << std::endl;
+        if (asyncSeconds > 0.0) {
+            std::cout << "    " << jobCount / asyncSeconds << " jobs/s, " << bytes / asyncSeconds / 1e9 <<
+                " GB/s (read + write)" << std::endl;
+        }
+        std::cout << std::endl;
 
-    uint32_t memoryTypeIndex = uint32_t(~0);
-    VkDeviceSize memoryHeapSize = uint32_t(~0);
-    for (uint32_t i = 0; i < physicalDeviceMemProps.memoryTypeCount; ++i) {
-        VkMemoryType memoryType = physicalDeviceMemProps.memoryTypes[i];
-        if ((memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
-            (memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
-            memoryTypeIndex = i;
-            memoryHeapSize = physicalDeviceMemProps.memoryHeaps[i].size;
-            break;
+        if (verify) {
+            std::cout << "Verification: " << (mismatches == 0 ? "passed" : "FAILED") << " (" << mismatches <<
+                " mismatches over " << jobCount << " jobs)" << std::endl << std::endl;
         }
+
+        printArenaStats(context.getMemoryArena());
+        writeProfile(profiler, profilePath);
+
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    std::cout << "Memory type index: " << memoryTypeIndex << std::endl;
-    std::cout << "Memory heap size: " << memoryHeapSize << std::endl << std::endl;
+    if (partition) {
+        if (partitionAllDevices) {
+            for (uint32_t device = 0; device < context.getPhysicalDeviceCount(); ++device) {
+                partitionDevices.push_back(static_cast<int>(device));
+            }
+        }
+        else if (partitionDevices.empty()) {
+            partitionDevices.push_back(contextOptions.deviceIndex);
+        }
 
+        // Every further device gets its own context and kernel; the same
+        // device may be listed twice, which gives it two VkDevices
+        std::vector<std::unique_ptr<ComputeContext>> deviceContexts;
+        std::vector<std::unique_ptr<ComputeKernel>> deviceKernels;
+        std::vector<PartitionTarget> targets;
+        for (uint32_t queueIndex = 0; queueIndex < context.getComputeQueueCount(); ++queueIndex) {
+            targets.push_back({ &context, &kernel, queueIndex });
+        }
+        for (size_t i = 1; i < partitionDevices.size(); ++i) {
+            ComputeContextOptions deviceOptions = contextOptions;
+            deviceOptions.deviceIndex = partitionDevices[i];
+            deviceOptions.profiler = nullptr;
+            deviceContexts.push_back(std::make_unique<ComputeContext>(deviceOptions));
+            ComputeContext& deviceContext = *deviceContexts.back();
+
+            uint32_t deviceWorkgroupSize = 0;
+            tuner.lookup(deviceContext, shaderPath, deviceWorkgroupSize);
+            deviceKernels.push_back(std::make_unique<ComputeKernel>(deviceContext, shaderPath, memoryMode, deviceWorkgroupSize));
+            deviceKernels.back()->setScale(scale);
+            for (uint32_t queueIndex = 0; queueIndex < deviceContext.getComputeQueueCount(); ++queueIndex) {
+                targets.push_back({ &deviceContext, deviceKernels.back().get(), queueIndex });
+            }
+        }
 
-    VkMemoryAllocateInfo inBufferMemoryAllocateInfo = {};
-    inBufferMemoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    inBufferMemoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
-    inBufferMemoryAllocateInfo.allocationSize = inBufferMemoryReq.size;
+        WorkPartitioner partitioner(targets);
+        {
+            ScopedPhase phase(&profiler, "partition_calibration");
+            partitioner.calibrate(std::max(elements, 1u << 20));
+        }
+        double totalWeight = 0.0;
+        for (size_t i = 0; i < partitioner.getTargetCount(); ++i) {
+            totalWeight += partitioner.getWeight(i);
+        }
+        std::cout << "Partitioning across " << partitioner.getTargetCount() << " queues:" << std::endl;
+        for (size_t i = 0; i < partitioner.getTargetCount(); ++i) {
+            std::cout << "    " << partitioner.describeTarget(i) << ": " << partitioner.getWeight(i) / 1e6 <<
+                " M elements/s (" << 100.0 * partitioner.getWeight(i) / totalWeight << "% of each job)" << std::endl;
+        }
+        std::cout << std::endl;
 
-    VkMemoryAllocateInfo outBufferMemoryAllocateInfo = {};
-    outBufferMemoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    outBufferMemoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
-    outBufferMemoryAllocateInfo.allocationSize = outBufferMemoryReq.size;
+        std::vector<double> jobMicroseconds(std::max(jobCount, 1u));
+        size_t mismatches = 0;
+        for (double& jobTime : jobMicroseconds) {
+            auto jobStart = Clock::now();
+            partitioner.run(dataVec, dataOutVec);
+            jobTime = std::chrono::duration<double, std::micro>(Clock::now() - jobStart).count();
+            profiler.record("partitioned_job", jobTime / 1000.0);
+            if (verify) {
+                mismatches += verifyOutput(cpuKernel, dataVec, dataOutVec, expectedVec);
+            }
+        }
+        std::sort(jobMicroseconds.begin(), jobMicroseconds.end());
+        const double median = jobMicroseconds[jobMicroseconds.size() / 2];
 
-    VkDeviceMemory inBufferMemory;
-    VkDeviceMemory outBufferMemory;
+        std::cout << "Jobs: " << jobMicroseconds.size() << " x " << elements << " elements, median " << median << " us, " <<
+            2.0 * elements * sizeof(uint32_t) / median / 1e3 << " GB/s (read + write)" << std::endl;
+        for (size_t i = 0; i < partitioner.getTargetCount(); ++i) {
+            std::cout << "    " << partitioner.describeTarget(i) << ": " << partitioner.getLastShare(i) << " elements" << std::endl;
+        }
+        std::cout << std::endl;
 
-    if (vkAllocateMemory(vulkanDevice, &inBufferMemoryAllocateInfo, nullptr, &inBufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to allocate input buffer memory");
-    }
-    if (vkAllocateMemory(vulkanDevice, &outBufferMemoryAllocateInfo, nullptr, &outBufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to allocate output buffer memory");
-    }
+        if (verify) {
+            std::cout << "Verification: " << (mismatches == 0 ? "passed" : "FAILED") << " (" << mismatches <<
+                " mismatches over " << jobMicroseconds.size() << " jobs)" << std::endl << std::endl;
+        }
 
-    // Map data to input buffer
-    std::vector<uint32_t> dataVec(elements);
+        printArenaStats(context.getMemoryArena());
+        writeProfile(profiler, profilePath);
 
-    for (uint32_t i = 0; i < elements; ++i) {
-        dataVec[i] = i;
+        return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    void* data;
-    vkMapMemory(vulkanDevice, inBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, dataVec.data(), bufferSize);
-    vkUnmapMemory(vulkanDevice, inBufferMemory);
-
-    if (vkBindBufferMemory(vulkanDevice, inBuffer, inBufferMemory, 0) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to bind input buffer");
+    // Verification needs GPU output for every job, so it turns the offload off
+    OffloadDispatcher dispatcher(kernel, cpuKernel);
+    if (!cpuOffload || verify) {
+        std::cout << "    CPU offload: disabled" << std::endl << std::endl;
     }
-    if (vkBindBufferMemory(vulkanDevice, outBuffer, outBufferMemory, 0) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to bind output buffer");
+    else if (cpuOffloadThreshold > 0) {
+        dispatcher.setThreshold(cpuOffloadThreshold);
+        std::cout << "    CPU offload: jobs below " << cpuOffloadThreshold << " elements (requested)" << std::endl << std::endl;
+    }
+    else {
+        {
+            ScopedPhase phase(&profiler, "offload_calibration");
+            dispatcher.calibrate();
+        }
+        std::cout << "    CPU offload: jobs below " << dispatcher.getThreshold() << " elements (calibrated in " <<
+            dispatcher.getCalibrationMilliseconds() << " ms)" << std::endl << std::endl;
     }
 
-    // Create shader module
-    auto compShader = readFile("compute_shader.comp.spv");
+    if (jobCount <= 1) {
+        JobTarget target = dispatcher.run(dataVec, dataOutVec);
 
-    VkShaderModuleCreateInfo shaderModuleCreateInfo{};
-    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderModuleCreateInfo.codeSize = compShader.size();
-    shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(compShader.data());
+        // Display results
+        std::cout << "Input buffer: ";
+        for (uint32_t i = 0; i < elements; ++i) {
+            std::cout << dataVec[i] << " ";
+        }
+        std::cout << std::endl;
 
-    VkShaderModule compShaderModule;
-    if (vkCreateShaderModule(vulkanDevice, &shaderModuleCreateInfo, nullptr, &compShaderModule) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create shader module");
-    }
-
-
-    // Create descriptor set layout
-    VkDescriptorSetLayoutBinding descriptorSetLayoutBindings[2];
-
-    for (uint32_t i = 0; i < 2; i++) {
-        VkDescriptorSetLayoutBinding binding = {};
-        binding.binding = i;
-        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        binding.descriptorCount = 1;
-        binding.stageFlags |= VK_SHADER_STAGE_COMPUTE_BIT;
-        descriptorSetLayoutBindings[i] = binding;
-    }
-
-    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
-    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo.bindingCount = 2;
-    descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings;
-
-    VkDescriptorSetLayout descriptorSetLayout;
-    if (vkCreateDescriptorSetLayout(vulkanDevice, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor set layout");
-    }
-    
-    // Create compute pipeline
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
-    pipelineLayoutCreateInfo.setLayoutCount = 1;
-    
-    VkPipelineLayout pipelineLayout;
-    if(vkCreatePipelineLayout(vulkanDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create pipeline layout");
-    }
-    
-    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VkPipelineCache pipelineCache;
-    if (vkCreatePipelineCache(vulkanDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache)) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create pipeline cache");
-    }
-    
-    VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo = {};
-    pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    pipelineShaderStageCreateInfo.pName = "main";
-    pipelineShaderStageCreateInfo.module = compShaderModule;
-    pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-
-    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
-    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    computePipelineCreateInfo.layout = pipelineLayout;
-    computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo;
-
-    VkPipeline computePipeline;
-    if (vkCreateComputePipelines(vulkanDevice, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &computePipeline)) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create compute pipeline");
-    }
-    
-    // Create descriptor pool and allocate descriptor set
-    VkDescriptorPoolSize descriptorPoolSize = {};
-    descriptorPoolSize.descriptorCount = 2;
-    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-
-    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
-    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
-    descriptorPoolCreateInfo.poolSizeCount = 1;
-    descriptorPoolCreateInfo.maxSets = 1;
-
-    VkDescriptorPool descriptorPool;
-    if (vkCreateDescriptorPool(vulkanDevice, &descriptorPoolCreateInfo, nullptr, &descriptorPool)) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor pool");
-    }
-
-    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptorSetAllocateInfo.descriptorPool = descriptorPool;
-    descriptorSetAllocateInfo.descriptorSetCount = 1;
-    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
-
-    std::vector<VkDescriptorSet> descriptorSetVec(1);
-    if (vkAllocateDescriptorSets(vulkanDevice, &descriptorSetAllocateInfo, descriptorSetVec.data()) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to allocate descriptor sets");
-    }
-
-    VkDescriptorSet descriptorSet = descriptorSetVec.front();
-
-    VkDescriptorBufferInfo inBufferInfo = {};
-    inBufferInfo.buffer = inBuffer;
-    inBufferInfo.offset = 0;
-    inBufferInfo.range = elements * sizeof(uint32_t);
-
-    VkDescriptorBufferInfo outBufferInfo = {};
-    outBufferInfo.buffer = outBuffer;
-    outBufferInfo.offset = 0;
-    outBufferInfo.range = elements * sizeof(uint32_t);
-    
-    VkWriteDescriptorSet writeInBufferDescriptorSet = {};
-    writeInBufferDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeInBufferDescriptorSet.dstBinding = 0;
-    writeInBufferDescriptorSet.dstArrayElement = 0;
-    writeInBufferDescriptorSet.descriptorCount = 1;
-    writeInBufferDescriptorSet.dstSet = descriptorSet;
-    writeInBufferDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    writeInBufferDescriptorSet.pBufferInfo = &inBufferInfo;
-
-    VkWriteDescriptorSet writeOutBufferDescriptorSet = {};
-    writeOutBufferDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeOutBufferDescriptorSet.dstBinding = 1;
-    writeOutBufferDescriptorSet.dstArrayElement = 0;
-    writeOutBufferDescriptorSet.descriptorCount = 1;
-    writeOutBufferDescriptorSet.dstSet = descriptorSet;
-    writeOutBufferDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    writeOutBufferDescriptorSet.pBufferInfo = &outBufferInfo;
-
-    const std::vector<VkWriteDescriptorSet> writeDescriptorSetVec = { writeInBufferDescriptorSet, writeOutBufferDescriptorSet };
-
-    vkUpdateDescriptorSets(vulkanDevice, 2, writeDescriptorSetVec.data(), 0, nullptr);
-
-    // Create command pool
-    VkCommandPoolCreateInfo cmdPoolCreateInfo = {};
-    cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    cmdPoolCreateInfo.queueFamilyIndex = computeQueueIndex;
-
-    VkCommandPool commandPool;
-    if (vkCreateCommandPool(vulkanDevice, &cmdPoolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create command pool");
-    }
-
-    // Allocate command buffers
-    uint32_t cmdBufferCount = 1;
-    VkCommandBufferAllocateInfo cmdBufferAllocateInfo = {};
-    cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    cmdBufferAllocateInfo.commandPool = commandPool;
-    cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    cmdBufferAllocateInfo.commandBufferCount = cmdBufferCount;
-
-    std::vector<VkCommandBuffer> cmdBufferVec(cmdBufferCount);
-    if (vkAllocateCommandBuffers(vulkanDevice, &cmdBufferAllocateInfo, cmdBufferVec.data()) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to allocate command buffers");
-    }
-    VkCommandBuffer commandBuffer = cmdBufferVec.front();
-
-    // Dispatch commands
-    VkCommandBufferBeginInfo cmdBufferBeginInfo = {};
-    cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    cmdBufferBeginInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    if (vkBeginCommandBuffer(commandBuffer, &cmdBufferBeginInfo) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to begin command buffer");
-    }
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-    vkCmdDispatch(commandBuffer, elements, 1, 1);
-    vkEndCommandBuffer(commandBuffer);
-
-    VkQueue queue;
-    vkGetDeviceQueue(vulkanDevice, computeQueueIndex, 0, &queue);
-
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        std::cout << "Output buffer: ";
+        for (uint32_t i = 0; i < elements; ++i) {
+            std::cout << dataOutVec[i] << " ";
+        }
+        std::cout << std::endl << std::endl;
 
-    VkFence fence;
-    if (vkCreateFence(vulkanDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed to create fence");
-    }
+        std::cout << "Ran on: " << (target == JobTarget::Gpu ? "GPU" : "CPU (below offload threshold)") << std::endl;
+        if (target == JobTarget::Gpu && kernel.hasGpuTimestamps()) {
+            std::cout << "GPU dispatch: " << kernel.getLastDispatchMilliseconds() * 1000.0 << " us" << std::endl;
+        }
+        std::cout << std::endl;
 
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = 0;
-    submitInfo.pWaitSemaphores = nullptr;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+        if (verify) {
+            const size_t mismatches = verifyOutput(cpuKernel, dataVec, dataOutVec, expectedVec);
+            std::cout << "Verification: " << (mismatches == 0 ? "passed" : "FAILED") << " (" << mismatches <<
+                " mismatches in " << elements << " elements)" << std::endl << std::endl;
+            if (mismatches > 0) {
+                return EXIT_FAILURE;
+            }
+        }
 
-    if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
-        throw std::runtime_error("RUNTIME ERROR: Failed submit command buffer to queue");
-    }
+        printArenaStats(context.getMemoryArena());
+        writeProfile(profiler, profilePath);
 
-    vkWaitForFences(vulkanDevice, 1, &fence, true, UINT64_MAX);
+        return EXIT_SUCCESS;
+    }
 
-    // Display results
-    std::vector<uint32_t> dataInVec(elements);
-    void* dataIn;
-    vkMapMemory(vulkanDevice, inBufferMemory, 0, bufferSize, 0, &dataIn);
-    memcpy(dataInVec.data(), dataIn, bufferSize);
-    vkUnmapMemory(vulkanDevice, inBufferMemory);
-
-    std::cout << "Input buffer: ";
-    for (uint32_t i = 0; i < elements; ++i) {
-        std::cout << dataInVec[i] << " ";
+    // Run many jobs on the same context. The first job pays for buffer allocation,
+    // so it is reported separately from the steady-state latency.
+    std::vector<double> jobMicroseconds(jobCount);
+    double dispatchTotal = 0.0;
+    uint32_t gpuJobs = 0;
+    size_t mismatches = 0;
+    for (uint32_t job = 0; job < jobCount; ++job) {
+        auto jobStart = Clock::now();
+        JobTarget target = dispatcher.run(dataVec, dataOutVec);
+        auto jobEnd = Clock::now();
+        jobMicroseconds[job] = std::chrono::duration<double, std::micro>(jobEnd - jobStart).count();
+        if (target == JobTarget::Gpu) {
+            dispatchTotal += kernel.getLastDispatchMilliseconds() * 1000.0;
+            ++gpuJobs;
+        }
+        // Checked outside the timed region
+        if (verify) {
+            mismatches += verifyOutput(cpuKernel, dataVec, dataOutVec, expectedVec);
+        }
     }
-    std::cout << std::endl;
 
-    std::vector<uint32_t> dataOutVec(elements);
-    void* dataOut;
-    vkMapMemory(vulkanDevice, outBufferMemory, 0, bufferSize, 0, &dataOut);
-    memcpy(dataOutVec.data(), dataOut, bufferSize);
-    vkUnmapMemory(vulkanDevice, outBufferMemory);
+    double steadyTotal = 0.0;
+    double steadyMin = jobMicroseconds[1];
+    double steadyMax = jobMicroseconds[1];
+    for (uint32_t job = 1; job < jobCount; ++job) {
+        steadyTotal += jobMicroseconds[job];
+        steadyMin = std::min(steadyMin, jobMicroseconds[job]);
+        steadyMax = std::max(steadyMax, jobMicroseconds[job]);
+    }
 
-    std::cout << "Output buffer: ";
-    for (uint32_t i = 0; i < elements; ++i) {
-        std::cout << dataOutVec[i] << " ";
+    std::cout << "Jobs: " << jobCount << " x " << elements << " elements (" << gpuJobs << " on the GPU, " <<
+        jobCount - gpuJobs << " on the CPU)" << std::endl;
+    std::cout << "    First job: " << jobMicroseconds[0] << " us" << std::endl;
+    std::cout << "    Per-job latency (amortized): mean " << steadyTotal / (jobCount - 1) <<
+        " us, min " << steadyMin << " us, max " << steadyMax << " us" << std::endl;
+    if (gpuJobs > 0 && kernel.hasGpuTimestamps()) {
+        std::cout << "    GPU dispatch: mean " << dispatchTotal / gpuJobs << " us" << std::endl;
     }
     std::cout << std::endl;
 
-    // Cleanup
-    vkResetCommandPool(vulkanDevice, commandPool, 0);
-    vkDestroyFence(vulkanDevice, fence, nullptr);
-    vkDestroyPipeline(vulkanDevice, computePipeline, nullptr);
-    vkDestroyPipelineCache(vulkanDevice, pipelineCache, nullptr);
-    vkDestroyPipelineLayout(vulkanDevice, pipelineLayout, nullptr);
-    vkDestroyDescriptorSetLayout(vulkanDevice, descriptorSetLayout, nullptr);
-    vkDestroyShaderModule(vulkanDevice, compShaderModule, nullptr);
-    vkDestroyDescriptorPool(vulkanDevice, descriptorPool, nullptr);
-    vkDestroyCommandPool(vulkanDevice, commandPool, nullptr);
-    vkFreeMemory(vulkanDevice, inBufferMemory, nullptr);
-    vkFreeMemory(vulkanDevice, outBufferMemory, nullptr);
-    vkDestroyBuffer(vulkanDevice, inBuffer, nullptr);
-    vkDestroyBuffer(vulkanDevice, outBuffer, nullptr);
-    vkDestroyDevice(vulkanDevice, nullptr);
-    vkDestroyInstance(instance, nullptr);
-
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    if (verify) {
+        std::cout << "Verification: " << (mismatches == 0 ? "passed" : "FAILED") << " (" << mismatches <<
+            " mismatches over " << jobCount << " jobs)" << std::endl << std::endl;
+    }
+
+    printArenaStats(context.getMemoryArena());
+    writeProfile(profiler, profilePath);
+
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,155 @@
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path, MappedFileAccess access, uint64_t requestedSize, uint64_t alignment) {
+    const bool write = access == MappedFileAccess::Write;
+    HANDLE file = CreateFileA(path.c_str(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+        write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to open " + path);
+    }
+    fileHandle = file;
+
+    if (write) {
+        size = requestedSize;
+    }
+    else {
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) {
+            CloseHandle(file);
+            throw std::runtime_error("RUNTIME ERROR: Failed to read the size of " + path);
+        }
+        size = static_cast<uint64_t>(fileSize.QuadPart);
+    }
+    if (size == 0) {
+        return;
+    }
+
+    // A read-write mapping of the requested size also sets the file's length
+    HANDLE mapping = CreateFileMappingA(file, nullptr, write ? PAGE_READWRITE : PAGE_WRITECOPY,
+        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        throw std::runtime_error("RUNTIME ERROR: Failed to map " + path);
+    }
+    mappingHandle = mapping;
+
+    data = MapViewOfFile(mapping, write ? FILE_MAP_WRITE : FILE_MAP_COPY, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("RUNTIME ERROR: Failed to map " + path);
+    }
+
+    // Views start on an allocation granularity boundary and end on a page
+    // boundary; the rest of the last page is zero
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    mappedSize = alignUp(size, systemInfo.dwPageSize);
+    (void)alignment;
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != nullptr) {
+        CloseHandle(mappingHandle);
+    }
+    CloseHandle(fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path, MappedFileAccess access, uint64_t requestedSize, uint64_t alignment) {
+    const bool write = access == MappedFileAccess::Write;
+    fileDescriptor = write ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to open " + path);
+    }
+
+    if (write) {
+        size = requestedSize;
+        if (ftruncate(fileDescriptor, static_cast<off_t>(size)) != 0) {
+            close(fileDescriptor);
+            throw std::runtime_error("RUNTIME ERROR: Failed to resize " + path);
+        }
+    }
+    else {
+        struct stat fileStat;
+        if (fstat(fileDescriptor, &fileStat) != 0) {
+            close(fileDescriptor);
+            throw std::runtime_error("RUNTIME ERROR: Failed to read the size of " + path);
+        }
+        size = static_cast<uint64_t>(fileStat.st_size);
+    }
+    if (size == 0) {
+        return;
+    }
+
+    // Reserve an aligned, padded range of anonymous memory, then map the file
+    // over its start. Pages past the end of the file stay anonymous, so the
+    // whole range is safe to touch.
+    const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    const uint64_t granularity = std::max(alignment, pageSize);
+    mappedSize = alignUp(size, granularity);
+    const size_t reservedSize = static_cast<size_t>(mappedSize + granularity - pageSize);
+
+    void* reserved = mmap(nullptr, reservedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        close(fileDescriptor);
+        throw std::runtime_error("RUNTIME ERROR: Failed to reserve address space for " + path);
+    }
+    char* reservedStart = static_cast<char*>(reserved);
+    char* alignedStart = reinterpret_cast<char*>(alignUp(reinterpret_cast<uintptr_t>(reservedStart), granularity));
+    if (alignedStart > reservedStart) {
+        munmap(reservedStart, static_cast<size_t>(alignedStart - reservedStart));
+    }
+    char* alignedEnd = alignedStart + mappedSize;
+    if (alignedEnd < reservedStart + reservedSize) {
+        munmap(alignedEnd, static_cast<size_t>(reservedStart + reservedSize - alignedEnd));
+    }
+
+    // Input pages are mapped copy-on-write and writable, since some drivers
+    // only import writable memory; the shader never writes them
+    void* mapped = mmap(alignedStart, static_cast<size_t>(size), PROT_READ | PROT_WRITE,
+        MAP_FIXED | (write ? MAP_SHARED : MAP_PRIVATE), fileDescriptor, 0);
+    if (mapped == MAP_FAILED) {
+        munmap(alignedStart, static_cast<size_t>(mappedSize));
+        close(fileDescriptor);
+        throw std::runtime_error("RUNTIME ERROR: Failed to map " + path);
+    }
+    data = mapped;
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) {
+        munmap(data, static_cast<size_t>(mappedSize));
+    }
+    close(fileDescriptor);
+}
+
+#endif
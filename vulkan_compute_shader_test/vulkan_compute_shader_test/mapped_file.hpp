@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+enum class MappedFileAccess {
+    // Copy-on-write view of an existing file; the pages stay shared with the
+    // page cache as long as nothing writes to them
+    Read,
+    // Creates or truncates the file to the requested size; writes go to the file
+    Write
+};
+
+// A whole file mapped into the address space with mmap, or MapViewOfFile on
+// Windows. The mapping is padded to a multiple of the requested alignment so
+// the entire range can be imported with VK_EXT_external_memory_host; bytes
+// past the end of the file read as zero and writes to them are discarded.
+// On Windows the padding only reaches the next page, so an alignment larger
+// than the page size may leave getMappedSize() short of it.
+class MappedFile {
+public:
+    MappedFile(const std::string& path, MappedFileAccess access, uint64_t size = 0, uint64_t alignment = 0);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Null for an empty file
+    void* getData() const { return data; }
+    uint64_t getSize() const { return size; }
+    // Accessible bytes starting at getData(), at least getSize()
+    uint64_t getMappedSize() const { return mappedSize; }
+
+private:
+    void* data = nullptr;
+    uint64_t size = 0;
+    uint64_t mappedSize = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
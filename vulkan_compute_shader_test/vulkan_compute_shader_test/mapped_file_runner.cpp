@@ -0,0 +1,236 @@
+#include "mapped_file_runner.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+
+MappedFileRunner::MappedFileRunner(ComputeContext& context, const ComputeKernel& kernel, const MappedFileOptions& options)
+    : context(context), kernel(kernel), allowImport(options.allowImport) {
+    VkDevice vulkanDevice = context.getDevice();
+
+    const uint32_t maxChunkElements = context.getDeviceProperties().limits.maxStorageBufferRange / sizeof(uint32_t);
+    chunkElements = std::min(std::max(options.chunkElements, 1u), maxChunkElements);
+    if (chunkElements < options.chunkElements) {
+        std::cout << "Chunk size clamped to " << chunkElements << " elements (maxStorageBufferRange)" << std::endl;
+    }
+
+    // Every job binds its buffers at a multiple of the chunk size inside the
+    // imported memory, so the chunk has to respect the buffer alignment
+    if (context.supportsHostPointerImport()) {
+        VkBuffer probeBuffer = createImportableBuffer(static_cast<VkDeviceSize>(chunkElements) * sizeof(uint32_t));
+        VkMemoryRequirements memoryReq;
+        vkGetBufferMemoryRequirements(vulkanDevice, probeBuffer, &memoryReq);
+        vkDestroyBuffer(vulkanDevice, probeBuffer, nullptr);
+
+        importMemoryTypeBits = memoryReq.memoryTypeBits;
+        importBufferAlignment = std::max<VkDeviceSize>(memoryReq.alignment, 1);
+        const uint32_t requestedChunkElements = chunkElements;
+        const uint32_t alignmentElements = static_cast<uint32_t>(std::max<VkDeviceSize>(importBufferAlignment / sizeof(uint32_t), 1));
+        // Chunks smaller than the alignment grow to it rather than binding at
+        // misaligned offsets; larger ones round down to stay within the range
+        if (chunkElements < alignmentElements) {
+            chunkElements = alignmentElements;
+        } else {
+            chunkElements -= chunkElements % alignmentElements;
+        }
+        if (chunkElements != requestedChunkElements) {
+            std::cout << "Chunk size aligned to " << chunkElements << " elements (import alignment)" << std::endl;
+        }
+    }
+
+    descriptorSet = context.allocateDescriptorSet(kernel.getDescriptorSetLayout());
+
+    VkCommandBufferAllocateInfo cmdBufferAllocateInfo = {};
+    cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufferAllocateInfo.commandPool = context.getCommandPool();
+    cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufferAllocateInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(vulkanDevice, &cmdBufferAllocateInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to allocate command buffers");
+    }
+
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if (vkCreateFence(vulkanDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create fence");
+    }
+}
+
+MappedFileRunner::~MappedFileRunner() {
+    VkDevice vulkanDevice = context.getDevice();
+    vkDeviceWaitIdle(vulkanDevice);
+
+    vkDestroyFence(vulkanDevice, fence, nullptr);
+    vkFreeCommandBuffers(vulkanDevice, context.getCommandPool(), 1, &commandBuffer);
+    context.freeDescriptorSet(descriptorSet);
+}
+
+VkBuffer MappedFileRunner::createImportableBuffer(VkDeviceSize size) const {
+    // Buffers bound to imported host memory must say so at creation
+    VkExternalMemoryBufferCreateInfo externalMemoryBufferCreateInfo = {};
+    externalMemoryBufferCreateInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    externalMemoryBufferCreateInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.pNext = &externalMemoryBufferCreateInfo;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer buffer;
+    if (vkCreateBuffer(context.getDevice(), &bufferCreateInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create buffer");
+    }
+    return buffer;
+}
+
+void MappedFileRunner::prepareSide(Side& side, void* data, uint64_t mappedSize, HostAccess access) {
+    if (allowImport && context.supportsHostPointerImport()) {
+        VkMemoryPropertyFlags propertyFlags = 0;
+        side.importedMemory = context.importHostPointer(data, mappedSize, importMemoryTypeBits, propertyFlags);
+
+        // Non-coherent memory would need flushes on memory the host never maps
+        if (side.importedMemory != VK_NULL_HANDLE && (propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0) {
+            context.freeMemory(side.importedMemory);
+            side.importedMemory = VK_NULL_HANDLE;
+        }
+        if (side.importedMemory != VK_NULL_HANDLE) {
+            return;
+        }
+    }
+
+    context.getMemoryArena().createBuffer(static_cast<VkDeviceSize>(chunkElements) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        access, side.copyBuffer, side.copyBufferMemory);
+}
+
+void MappedFileRunner::releaseSide(Side& side) {
+    if (side.importedMemory != VK_NULL_HANDLE) {
+        context.freeMemory(side.importedMemory);
+        side.importedMemory = VK_NULL_HANDLE;
+    }
+    if (side.copyBuffer != VK_NULL_HANDLE) {
+        context.getMemoryArena().destroyBuffer(side.copyBuffer, side.copyBufferMemory);
+    }
+}
+
+MappedFileStats MappedFileRunner::run(const std::string& inputPath, const std::string& outputPath) {
+    VkDevice vulkanDevice = context.getDevice();
+    const uint64_t alignment = context.supportsHostPointerImport() ? context.getMinImportedHostPointerAlignment() : 0;
+
+    MappedFile input(inputPath, MappedFileAccess::Read, 0, alignment);
+    const uint64_t elements = (input.getSize() + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    MappedFile output(outputPath, MappedFileAccess::Write, elements * sizeof(uint32_t), alignment);
+
+    MappedFileStats stats;
+    stats.elements = elements;
+    if (elements == 0) {
+        return stats;
+    }
+
+    Side inputSide;
+    Side outputSide;
+    // Per-job buffers bound into the imported memory; null on the copy path
+    VkBuffer importedInBuffer = VK_NULL_HANDLE;
+    VkBuffer importedOutBuffer = VK_NULL_HANDLE;
+    bool submitted = false;
+
+    try {
+        prepareSide(inputSide, input.getData(), input.getMappedSize(), HostAccess::Upload);
+        prepareSide(outputSide, output.getData(), output.getMappedSize(), HostAccess::Readback);
+        stats.inputImported = inputSide.importedMemory != VK_NULL_HANDLE;
+        stats.outputImported = outputSide.importedMemory != VK_NULL_HANDLE;
+
+        // The mappings are padded past the last element, so whole elements can
+        // be copied even when the file ends mid-element
+        const char* inputData = static_cast<const char*>(input.getData());
+        char* outputData = static_cast<char*>(output.getData());
+
+        auto runStart = std::chrono::steady_clock::now();
+        for (uint64_t offset = 0; offset < elements; offset += chunkElements) {
+            const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(chunkElements, elements - offset));
+            const VkDeviceSize byteOffset = offset * sizeof(uint32_t);
+            const VkDeviceSize bytes = static_cast<VkDeviceSize>(count) * sizeof(uint32_t);
+
+            if (stats.inputImported) {
+                importedInBuffer = createImportableBuffer(bytes);
+                if (vkBindBufferMemory(vulkanDevice, importedInBuffer, inputSide.importedMemory, byteOffset) != VK_SUCCESS) {
+                    throw std::runtime_error("RUNTIME ERROR: Failed to bind buffer memory");
+                }
+            }
+            else {
+                memcpy(inputSide.copyBufferMemory.mapped, inputData + byteOffset, bytes);
+                context.getMemoryArena().flush(inputSide.copyBufferMemory, 0, bytes);
+                stats.bytesCopied += bytes;
+            }
+            if (stats.outputImported) {
+                importedOutBuffer = createImportableBuffer(bytes);
+                if (vkBindBufferMemory(vulkanDevice, importedOutBuffer, outputSide.importedMemory, byteOffset) != VK_SUCCESS) {
+                    throw std::runtime_error("RUNTIME ERROR: Failed to bind buffer memory");
+                }
+            }
+            const VkBuffer inBuffer = stats.inputImported ? importedInBuffer : inputSide.copyBuffer;
+            const VkBuffer outBuffer = stats.outputImported ? importedOutBuffer : outputSide.copyBuffer;
+
+            // The buffers change every job, so the command buffer is recorded fresh
+            kernel.writeDescriptorSet(descriptorSet, inBuffer, outBuffer, count);
+            beginOneTimeCommandBuffer(commandBuffer);
+            kernel.recordDispatch(commandBuffer, descriptorSet, count);
+            memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+            vkEndCommandBuffer(commandBuffer);
+
+            VkSubmitInfo submitInfo = {};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+
+            vkResetFences(vulkanDevice, 1, &fence);
+            if (vkQueueSubmit(context.getQueue(), 1, &submitInfo, fence) != VK_SUCCESS) {
+                throw std::runtime_error("RUNTIME ERROR: Failed submit command buffer to queue");
+            }
+            submitted = true;
+            vkWaitForFences(vulkanDevice, 1, &fence, true, UINT64_MAX);
+            submitted = false;
+
+            if (!stats.outputImported) {
+                context.getMemoryArena().invalidate(outputSide.copyBufferMemory, 0, bytes);
+                memcpy(outputData + byteOffset, outputSide.copyBufferMemory.mapped, bytes);
+                stats.bytesCopied += bytes;
+            }
+            vkDestroyBuffer(vulkanDevice, importedInBuffer, nullptr);
+            vkDestroyBuffer(vulkanDevice, importedOutBuffer, nullptr);
+            importedInBuffer = VK_NULL_HANDLE;
+            importedOutBuffer = VK_NULL_HANDLE;
+            stats.jobs++;
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+    }
+    catch (...) {
+        // The GPU must be done with the file pages, and the imported memory
+        // gone, before the mappings are destroyed on the way out
+        if (submitted) {
+            vkWaitForFences(vulkanDevice, 1, &fence, true, UINT64_MAX);
+        }
+        vkDestroyBuffer(vulkanDevice, importedInBuffer, nullptr);
+        vkDestroyBuffer(vulkanDevice, importedOutBuffer, nullptr);
+        releaseSide(inputSide);
+        releaseSide(outputSide);
+        throw;
+    }
+
+    // The imported memory has to go before the mappings behind it
+    releaseSide(inputSide);
+    releaseSide(outputSide);
+
+    if (stats.seconds > 0.0) {
+        stats.gigabytesPerSecond = (input.getSize() + output.getSize()) / stats.seconds / 1e9;
+    }
+    return stats;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "compute_kernel.hpp"
+#include "memory_arena.hpp"
+
+#include <string>
+
+struct MappedFileOptions {
+    // Elements per job; clamped so a job never exceeds maxStorageBufferRange
+    uint32_t chunkElements = 1 << 22;
+    // False always takes the copying path, for comparison
+    bool allowImport = true;
+};
+
+struct MappedFileStats {
+    uint64_t elements = 0;
+    uint32_t jobs = 0;
+    bool inputImported = false;
+    bool outputImported = false;
+    // Bytes the host copied between the mapped files and device-visible memory
+    uint64_t bytesCopied = 0;
+    double seconds = 0.0;
+    // Input plus output bytes / seconds, in 10^9 bytes per second
+    double gigabytesPerSecond = 0.0;
+};
+
+// Runs a kernel over a file of little-endian uint32 values and writes the
+// results to another file, both memory-mapped. When the device supports
+// VK_EXT_external_memory_host each mapping is imported as device memory and
+// every job's storage buffers are bound straight onto the file pages, so the
+// host copies nothing. A mapping the driver refuses falls back to one memcpy
+// per job and direction through a host-visible buffer. A trailing partial
+// element is zero-padded, as in StreamRunner.
+//
+// Jobs run one at a time; the point is the copies saved, not overlap.
+class MappedFileRunner {
+public:
+    MappedFileRunner(ComputeContext& context, const ComputeKernel& kernel, const MappedFileOptions& options = MappedFileOptions());
+    ~MappedFileRunner();
+
+    MappedFileRunner(const MappedFileRunner&) = delete;
+    MappedFileRunner& operator=(const MappedFileRunner&) = delete;
+
+    MappedFileStats run(const std::string& inputPath, const std::string& outputPath);
+
+    uint32_t getChunkElements() const { return chunkElements; }
+
+private:
+    // One side of the job: either imported file memory or a host-visible
+    // buffer the file data is copied through
+    struct Side {
+        VkDeviceMemory importedMemory = VK_NULL_HANDLE;
+        VkBuffer copyBuffer = VK_NULL_HANDLE;
+        ArenaAllocation copyBufferMemory;
+    };
+
+    VkBuffer createImportableBuffer(VkDeviceSize size) const;
+    // Imports the mapping, or allocates the copy buffer when that fails
+    void prepareSide(Side& side, void* data, uint64_t mappedSize, HostAccess access);
+    void releaseSide(Side& side);
+
+    ComputeContext& context;
+    const ComputeKernel& kernel;
+    uint32_t chunkElements = 0;
+    bool allowImport = true;
+    uint32_t importMemoryTypeBits = 0;
+    VkDeviceSize importBufferAlignment = 1;
+
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+};
@@ -0,0 +1,362 @@
+#include "memory_arena.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+// True when the last byte of one resource and the first byte of the next fall on the same page
+static bool onSamePage(VkDeviceSize lastByte, VkDeviceSize firstByte, VkDeviceSize pageSize) {
+    return lastByte / pageSize == firstByte / pageSize;
+}
+
+MemoryArena::MemoryArena(const ComputeContext& context, ArenaMode mode, VkDeviceSize blockSize)
+    : context(context), mode(mode), blockSize(blockSize) {
+    bufferImageGranularity = std::max<VkDeviceSize>(1, context.getDeviceProperties().limits.bufferImageGranularity);
+}
+
+MemoryArena::~MemoryArena() {
+    VkDevice vulkanDevice = context.getDevice();
+    for (auto& block : blocks) {
+        if (block.mapped != nullptr) {
+            vkUnmapMemory(vulkanDevice, block.memory);
+        }
+        context.freeMemory(block.memory);
+    }
+}
+
+MemoryArena::Block& MemoryArena::createBlock(uint32_t memoryTypeIndex, VkDeviceSize minSize) {
+    VkDevice vulkanDevice = context.getDevice();
+
+    // Refuse the block before the driver has to. The context counts every
+    // arena's blocks and every import, so other owners' memory is included
+    // even without VK_EXT_memory_budget.
+    const VkMemoryType& memoryType = context.getMemoryProperties().memoryTypes[memoryTypeIndex];
+    const MemoryHeapBudget heap = context.getMemoryBudget()[memoryType.heapIndex];
+    const VkDeviceSize heapHeadroom = heap.budget > heap.usage ? heap.budget - heap.usage : 0;
+    if (minSize > heapHeadroom) {
+        throw std::runtime_error("RUNTIME ERROR: Allocation of " + std::to_string(minSize) + " bytes exceeds the memory budget of heap " +
+            std::to_string(memoryType.heapIndex) + " (" + std::to_string(heapHeadroom) + " bytes left)");
+    }
+
+    VkMemoryAllocateInfo memoryAllocateInfo = {};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+    memoryAllocateInfo.allocationSize = std::min(std::max(blockSize, minSize), heapHeadroom);
+
+    VkDeviceMemory memory;
+    VkResult result = context.allocateMemory(memoryAllocateInfo, memory);
+    if (result == VK_ERROR_TOO_MANY_OBJECTS) {
+        throw std::runtime_error("RUNTIME ERROR: Memory arena reached maxMemoryAllocationCount");
+    }
+    if (result != VK_SUCCESS && memoryAllocateInfo.allocationSize > minSize) {
+        // The heap may be too small or too full for a whole block; fall back to an exact fit
+        memoryAllocateInfo.allocationSize = minSize;
+        result = context.allocateMemory(memoryAllocateInfo, memory);
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to allocate memory arena block");
+    }
+
+    Block block = {};
+    block.memory = memory;
+    block.size = memoryAllocateInfo.allocationSize;
+    block.memoryTypeIndex = memoryTypeIndex;
+    block.mapped = nullptr;
+    block.ranges[0] = Range{ block.size, true, true };
+    block.head = 0;
+    block.lastLinear = true;
+    block.liveAllocations = 0;
+    block.usedBytes = 0;
+    block.generation = 0;
+
+    if (memoryType.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(vulkanDevice, memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS) {
+            context.freeMemory(memory);
+            throw std::runtime_error("RUNTIME ERROR: Failed to map memory arena block");
+        }
+    }
+
+    blocks.push_back(block);
+    return blocks.back();
+}
+
+bool MemoryArena::allocateFromBlock(Block& block, const VkMemoryRequirements& memoryReq, bool linear, VkDeviceSize& offset) {
+    if (mode == ArenaMode::Linear) {
+        VkDeviceSize start = alignUp(block.head, memoryReq.alignment);
+        if (block.head > 0 && block.lastLinear != linear &&
+            onSamePage(block.head - 1, start, bufferImageGranularity)) {
+            start = alignUp(start, bufferImageGranularity);
+        }
+        if (start + memoryReq.size > block.size) {
+            return false;
+        }
+
+        block.head = start + memoryReq.size;
+        block.lastLinear = linear;
+        offset = start;
+        return true;
+    }
+
+    // First fit over the free ranges. Free ranges are always merged, so the
+    // neighbours of a free range are either used or absent.
+    for (auto it = block.ranges.begin(); it != block.ranges.end(); ++it) {
+        if (!it->second.free || it->second.size < memoryReq.size) {
+            continue;
+        }
+
+        const VkDeviceSize rangeStart = it->first;
+        const VkDeviceSize rangeEnd = it->first + it->second.size;
+
+        VkDeviceSize start = alignUp(rangeStart, memoryReq.alignment);
+        if (it != block.ranges.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.linear != linear &&
+                onSamePage(prev->first + prev->second.size - 1, start, bufferImageGranularity)) {
+                start = alignUp(start, bufferImageGranularity);
+            }
+        }
+
+        const VkDeviceSize end = start + memoryReq.size;
+        if (end > rangeEnd) {
+            continue;
+        }
+
+        auto next = std::next(it);
+        if (next != block.ranges.end() && next->second.linear != linear &&
+            onSamePage(end - 1, next->first, bufferImageGranularity)) {
+            continue;
+        }
+
+        block.ranges.erase(it);
+        if (start > rangeStart) {
+            block.ranges[rangeStart] = Range{ start - rangeStart, true, true };
+        }
+        block.ranges[start] = Range{ memoryReq.size, false, linear };
+        if (end < rangeEnd) {
+            block.ranges[end] = Range{ rangeEnd - end, true, true };
+        }
+
+        offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+ArenaAllocation MemoryArena::allocate(const VkMemoryRequirements& memoryReq, VkMemoryPropertyFlags propertyFlags, bool linear) {
+    return allocateFromType(memoryReq, context.findMemoryType(memoryReq.memoryTypeBits, propertyFlags), linear);
+}
+
+ArenaAllocation MemoryArena::allocate(const VkMemoryRequirements& memoryReq, HostAccess access, bool linear) {
+    return allocateFromType(memoryReq, context.findHostMemoryType(memoryReq.memoryTypeBits, access), linear);
+}
+
+ArenaAllocation MemoryArena::allocateFromType(const VkMemoryRequirements& memoryReq, uint32_t memoryTypeIndex, bool linear) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    VkDeviceSize offset = 0;
+    uint32_t blockIndex = 0;
+    bool found = false;
+    for (; blockIndex < blocks.size(); ++blockIndex) {
+        Block& block = blocks[blockIndex];
+        if (block.memoryTypeIndex == memoryTypeIndex && allocateFromBlock(block, memoryReq, linear, offset)) {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        // Leave room for the worst-case alignment padding
+        Block& block = createBlock(memoryTypeIndex, memoryReq.size + memoryReq.alignment);
+        blockIndex = static_cast<uint32_t>(blocks.size() - 1);
+        if (!allocateFromBlock(block, memoryReq, linear, offset)) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to sub-allocate from new memory arena block");
+        }
+    }
+
+    Block& block = blocks[blockIndex];
+    block.liveAllocations++;
+    block.usedBytes += memoryReq.size;
+
+    ArenaAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = memoryReq.size;
+    allocation.mapped = block.mapped != nullptr ? static_cast<char*>(block.mapped) + offset : nullptr;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.blockIndex = blockIndex;
+    allocation.generation = block.generation;
+    allocation.coherent = (context.getMemoryProperties().memoryTypes[memoryTypeIndex].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    return allocation;
+}
+
+void MemoryArena::free(const ArenaAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Block& block = blocks[allocation.blockIndex];
+    if (allocation.generation != block.generation) {
+        return;
+    }
+    block.liveAllocations--;
+    block.usedBytes -= allocation.size;
+
+    if (mode == ArenaMode::Linear) {
+        // Space is only reclaimed once the whole block is empty
+        if (block.liveAllocations == 0) {
+            block.head = 0;
+        }
+        return;
+    }
+
+    auto it = block.ranges.find(allocation.offset);
+    if (it == block.ranges.end() || it->second.free) {
+        throw std::runtime_error("RUNTIME ERROR: Invalid memory arena free");
+    }
+    it->second.free = true;
+    it->second.linear = true;
+
+    auto next = std::next(it);
+    if (next != block.ranges.end() && next->second.free) {
+        it->second.size += next->second.size;
+        block.ranges.erase(next);
+    }
+    if (it != block.ranges.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second.free) {
+            prev->second.size += it->second.size;
+            block.ranges.erase(it);
+        }
+    }
+}
+
+void MemoryArena::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto& block : blocks) {
+        block.ranges.clear();
+        block.ranges[0] = Range{ block.size, true, true };
+        block.head = 0;
+        block.lastLinear = true;
+        block.liveAllocations = 0;
+        block.usedBytes = 0;
+        block.generation++;
+    }
+}
+
+void MemoryArena::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags propertyFlags,
+    VkBuffer& buffer, ArenaAllocation& allocation, bool shareWithTransferQueue) {
+    VkDevice vulkanDevice = context.getDevice();
+
+    buffer = context.createBufferHandle(size, usage, shareWithTransferQueue);
+
+    VkMemoryRequirements bufferMemoryReq;
+    vkGetBufferMemoryRequirements(vulkanDevice, buffer, &bufferMemoryReq);
+
+    allocation = allocate(bufferMemoryReq, propertyFlags);
+    if (vkBindBufferMemory(vulkanDevice, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to bind buffer memory");
+    }
+}
+
+void MemoryArena::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, HostAccess access,
+    VkBuffer& buffer, ArenaAllocation& allocation, bool shareWithTransferQueue) {
+    VkDevice vulkanDevice = context.getDevice();
+
+    buffer = context.createBufferHandle(size, usage, shareWithTransferQueue);
+
+    VkMemoryRequirements bufferMemoryReq;
+    vkGetBufferMemoryRequirements(vulkanDevice, buffer, &bufferMemoryReq);
+
+    allocation = allocate(bufferMemoryReq, access);
+    if (vkBindBufferMemory(vulkanDevice, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to bind buffer memory");
+    }
+}
+
+bool MemoryArena::nonCoherentRange(const ArenaAllocation& allocation, VkDeviceSize offset, VkDeviceSize size,
+    VkMappedMemoryRange& range) const {
+    if (allocation.coherent || allocation.memory == VK_NULL_HANDLE || size == 0) {
+        return false;
+    }
+
+    // Ranges must start and end on nonCoherentAtomSize boundaries, or end at
+    // the end of the memory object
+    const VkDeviceSize atomSize = std::max<VkDeviceSize>(1, context.getDeviceProperties().limits.nonCoherentAtomSize);
+    const VkDeviceSize start = (allocation.offset + offset) / atomSize * atomSize;
+    VkDeviceSize end = alignUp(allocation.offset + offset + size, atomSize);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        end = std::min(end, blocks[allocation.blockIndex].size);
+    }
+
+    range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.memory;
+    range.offset = start;
+    range.size = end - start;
+    return true;
+}
+
+void MemoryArena::flush(const ArenaAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const {
+    VkMappedMemoryRange range;
+    if (nonCoherentRange(allocation, offset, size, range) &&
+        vkFlushMappedMemoryRanges(context.getDevice(), 1, &range) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to flush mapped memory");
+    }
+}
+
+void MemoryArena::invalidate(const ArenaAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const {
+    VkMappedMemoryRange range;
+    if (nonCoherentRange(allocation, offset, size, range) &&
+        vkInvalidateMappedMemoryRanges(context.getDevice(), 1, &range) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to invalidate mapped memory");
+    }
+}
+
+void MemoryArena::destroyBuffer(VkBuffer& buffer, ArenaAllocation& allocation) {
+    vkDestroyBuffer(context.getDevice(), buffer, nullptr);
+    free(allocation);
+    buffer = VK_NULL_HANDLE;
+    allocation = ArenaAllocation();
+}
+
+ArenaStats MemoryArena::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    ArenaStats stats;
+    VkDeviceSize bytesFree = 0;
+    for (const auto& block : blocks) {
+        stats.blockCount++;
+        stats.allocationCount += block.liveAllocations;
+        stats.bytesReserved += block.size;
+        stats.bytesUsed += block.usedBytes;
+
+        if (mode == ArenaMode::Linear) {
+            bytesFree += block.size - block.head;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, block.size - block.head);
+            continue;
+        }
+        for (const auto& range : block.ranges) {
+            if (range.second.free) {
+                bytesFree += range.second.size;
+                stats.largestFreeRange = std::max(stats.largestFreeRange, range.second.size);
+            }
+        }
+    }
+
+    if (bytesFree > 0) {
+        stats.fragmentation = 1.0 - static_cast<double>(stats.largestFreeRange) / static_cast<double>(bytesFree);
+    }
+    return stats;
+}
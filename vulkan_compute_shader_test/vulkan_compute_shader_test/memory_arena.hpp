@@ -0,0 +1,115 @@
+#pragma once
+
+#include "compute_context.hpp"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+// FreeList keeps every allocation until it is freed and merges neighbouring
+// free ranges. Linear only bumps an offset and releases everything at once on
+// reset(), which is the cheapest option for per-job transient buffers.
+enum class ArenaMode {
+    FreeList,
+    Linear
+};
+
+struct ArenaAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Points at offset inside the block when the memory type is host-visible
+    void* mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+    uint32_t blockIndex = 0;
+    // False when host writes need flush() and device writes need invalidate()
+    bool coherent = true;
+    // The block's reset() count when this was allocated; free() ignores
+    // allocations that a later reset() already released
+    uint32_t generation = 0;
+};
+
+struct ArenaStats {
+    uint32_t blockCount = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize bytesReserved = 0;
+    VkDeviceSize bytesUsed = 0;
+    VkDeviceSize largestFreeRange = 0;
+    // 1 - largest free range / total free bytes; 0 when all free space is contiguous
+    double fragmentation = 0.0;
+};
+
+// Allocates large VkDeviceMemory blocks per memory type and hands out
+// sub-ranges of them, so the number of vkAllocateMemory calls stays far below
+// maxMemoryAllocationCount. Host-visible blocks are mapped once for their
+// whole lifetime. A new block is refused with an exception when it would push
+// its heap past the memory budget, rather than letting the driver run out.
+class MemoryArena {
+public:
+    static constexpr VkDeviceSize defaultBlockSize = 64ull * 1024 * 1024;
+
+    MemoryArena(const ComputeContext& context, ArenaMode mode, VkDeviceSize blockSize = defaultBlockSize);
+    ~MemoryArena();
+
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    // linear is false for optimally tiled images, which must not share a
+    // bufferImageGranularity page with linear resources
+    ArenaAllocation allocate(const VkMemoryRequirements& memoryReq, VkMemoryPropertyFlags propertyFlags, bool linear = true);
+    ArenaAllocation allocate(const VkMemoryRequirements& memoryReq, HostAccess access, bool linear = true);
+    void free(const ArenaAllocation& allocation);
+    // Releases every allocation at once but keeps the blocks for reuse.
+    // Freeing an allocation made before the reset is a no-op.
+    void reset();
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags propertyFlags,
+        VkBuffer& buffer, ArenaAllocation& allocation, bool shareWithTransferQueue = false);
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, HostAccess access,
+        VkBuffer& buffer, ArenaAllocation& allocation, bool shareWithTransferQueue = false);
+    void destroyBuffer(VkBuffer& buffer, ArenaAllocation& allocation);
+
+    // Make host writes visible to the device, or device writes visible to the
+    // host, for size bytes at offset inside a mapped allocation. No-ops on
+    // coherent memory; otherwise the range is widened to nonCoherentAtomSize.
+    void flush(const ArenaAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+    void invalidate(const ArenaAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+    ArenaMode getMode() const { return mode; }
+    ArenaStats getStats() const;
+
+private:
+    struct Range {
+        VkDeviceSize size;
+        bool free;
+        bool linear;
+    };
+
+    struct Block {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint32_t memoryTypeIndex;
+        void* mapped;
+        // FreeList mode: every used and free range, keyed by offset
+        std::map<VkDeviceSize, Range> ranges;
+        // Linear mode: bump offset and the kind of the last allocation
+        VkDeviceSize head;
+        bool lastLinear;
+        uint32_t liveAllocations;
+        VkDeviceSize usedBytes;
+        uint32_t generation;
+    };
+
+    ArenaAllocation allocateFromType(const VkMemoryRequirements& memoryReq, uint32_t memoryTypeIndex, bool linear);
+    bool allocateFromBlock(Block& block, const VkMemoryRequirements& memoryReq, bool linear, VkDeviceSize& offset);
+    Block& createBlock(uint32_t memoryTypeIndex, VkDeviceSize minSize);
+    // Fills range with the atom-aligned span covering size bytes at offset
+    bool nonCoherentRange(const ArenaAllocation& allocation, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange& range) const;
+
+    const ComputeContext& context;
+    ArenaMode mode;
+    VkDeviceSize blockSize;
+    VkDeviceSize bufferImageGranularity;
+    std::vector<Block> blocks;
+    mutable std::mutex mutex;
+};
@@ -0,0 +1,198 @@
+#include "micro_batcher.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double>& sorted, uint32_t percent) {
+    const size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+MicroBatcher::MicroBatcher(ComputeContext& context, const ComputeKernel& kernel, const MicroBatchOptions& options)
+    : context(context), slot(context, kernel), maxWait(options.maxWaitMicroseconds) {
+    const uint32_t maxElements = context.getDeviceProperties().limits.maxStorageBufferRange / sizeof(uint32_t);
+    maxBatchElements = std::min(std::max(options.maxBatchElements, 1u), maxElements);
+
+    // Full batches never reallocate; only an oversized request grows the slot
+    slot.reserve(maxBatchElements);
+
+    schedulerThread = std::thread(&MicroBatcher::schedulerLoop, this);
+}
+
+MicroBatcher::~MicroBatcher() {
+    stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+    }
+    wake.notify_all();
+    schedulerThread.join();
+}
+
+std::future<std::vector<uint32_t>> MicroBatcher::enqueue(std::vector<uint32_t> input) {
+    std::unique_ptr<Request> request = std::make_unique<Request>();
+    std::future<std::vector<uint32_t>> future = request->result.get_future();
+    if (input.empty()) {
+        request->result.set_value({});
+        return future;
+    }
+
+    const uint32_t maxElements = context.getDeviceProperties().limits.maxStorageBufferRange / sizeof(uint32_t);
+    if (input.size() > maxElements) {
+        throw std::runtime_error("RUNTIME ERROR: Job exceeds maxStorageBufferRange");
+    }
+    const uint64_t elements = input.size();
+    request->input = std::move(input);
+    request->enqueueTime = Clock::now();
+
+    const uint64_t previous = queuedElements.fetch_add(elements);
+    Request* node = request.release();
+    node->next = queueHead.load(std::memory_order_relaxed);
+    while (!queueHead.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+
+    // Only the request that crosses the threshold pays for the mutex. The
+    // scheduler stores the threshold before it checks queuedElements, so
+    // either it sees this request or this request sees its threshold.
+    const uint64_t threshold = wakeThreshold.load();
+    if (previous < threshold && previous + elements >= threshold) {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wake.notify_one();
+    }
+    return future;
+}
+
+MicroBatchStats MicroBatcher::getStats() const {
+    std::vector<double> sorted;
+    MicroBatchStats stats;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        sorted = latencyMicroseconds;
+        stats.batches = batchCount;
+        stats.elements = elementCount;
+    }
+    stats.requests = sorted.size();
+    if (sorted.empty()) {
+        return stats;
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+    stats.latencyP50Microseconds = percentile(sorted, 50);
+    stats.latencyP90Microseconds = percentile(sorted, 90);
+    stats.latencyP99Microseconds = percentile(sorted, 99);
+    stats.latencyMaxMicroseconds = sorted.back();
+    return stats;
+}
+
+void MicroBatcher::takeQueued() {
+    Request* newest = queueHead.exchange(nullptr, std::memory_order_acquire);
+
+    // The list runs newest to oldest; reverse it so batches keep arrival order
+    Request* oldest = nullptr;
+    while (newest != nullptr) {
+        Request* next = newest->next;
+        newest->next = oldest;
+        oldest = newest;
+        newest = next;
+    }
+
+    uint64_t taken = 0;
+    while (oldest != nullptr) {
+        Request* next = oldest->next;
+        taken += oldest->input.size();
+        pending.emplace_back(oldest);
+        oldest = next;
+    }
+    pendingElements += taken;
+    queuedElements.fetch_sub(taken);
+}
+
+void MicroBatcher::schedulerLoop() {
+    for (;;) {
+        // Read before taking, so everything enqueued before the destructor
+        // ran is dispatched before the loop exits
+        const bool stop = stopping.load();
+        takeQueued();
+
+        if (!pending.empty() && (stop || pendingElements >= maxBatchElements ||
+            Clock::now() >= pending.front()->enqueueTime + maxWait)) {
+            dispatchBatch();
+            continue;
+        }
+        if (stop) {
+            return;
+        }
+
+        // Sleep until enough elements are queued to fill the batch, or until
+        // the oldest pending request reaches its deadline
+        const uint64_t threshold = pending.empty() ? 1 : maxBatchElements - pendingElements;
+        wakeThreshold.store(threshold);
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        auto wakeCondition = [this, threshold] { return stopping.load() || queuedElements.load() >= threshold; };
+        if (pending.empty()) {
+            wake.wait(lock, wakeCondition);
+        }
+        else {
+            wake.wait_until(lock, pending.front()->enqueueTime + maxWait, wakeCondition);
+        }
+    }
+}
+
+void MicroBatcher::dispatchBatch() {
+    // Whole requests from the front, up to maxBatchElements; a request larger
+    // than that is always taken, alone
+    size_t count = 0;
+    uint32_t batchElements = 0;
+    batchOffsets.clear();
+    while (count < pending.size()) {
+        const uint32_t requestElements = static_cast<uint32_t>(pending[count]->input.size());
+        if (count > 0 && static_cast<uint64_t>(batchElements) + requestElements > maxBatchElements) {
+            break;
+        }
+        batchOffsets.push_back(batchElements);
+        batchElements += requestElements;
+        ++count;
+    }
+
+    std::vector<std::unique_ptr<Request>> batch;
+    batch.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        batch.push_back(std::move(pending.front()));
+        pending.pop_front();
+    }
+    pendingElements -= batchElements;
+
+    size_t resolved = 0;
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    try {
+        slot.reserve(batchElements);
+        uint32_t* uploadData = static_cast<uint32_t*>(slot.getUploadData());
+        for (size_t i = 0; i < count; ++i) {
+            memcpy(uploadData + batchOffsets[i], batch[i]->input.data(), batch[i]->input.size() * sizeof(uint32_t));
+        }
+
+        slot.submit(batchElements);
+        slot.wait();
+
+        const uint32_t* readbackData = static_cast<const uint32_t*>(slot.getReadbackData(batchElements));
+        for (; resolved < count; ++resolved) {
+            const uint32_t* requestData = readbackData + batchOffsets[resolved];
+            batch[resolved]->result.set_value(std::vector<uint32_t>(requestData, requestData + batch[resolved]->input.size()));
+            latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - batch[resolved]->enqueueTime).count());
+        }
+    }
+    catch (...) {
+        for (; resolved < count; ++resolved) {
+            batch[resolved]->result.set_exception(std::current_exception());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    batchCount++;
+    elementCount += batchElements;
+    latencyMicroseconds.insert(latencyMicroseconds.end(), latencies.begin(), latencies.end());
+}
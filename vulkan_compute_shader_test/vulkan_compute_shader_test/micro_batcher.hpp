@@ -0,0 +1,114 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "compute_kernel.hpp"
+#include "job_slot.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct MicroBatchOptions {
+    // A batch is dispatched once it holds this many elements; clamped to
+    // maxStorageBufferRange
+    uint32_t maxBatchElements = 1 << 16;
+    // ... or once its oldest request has waited this long
+    uint32_t maxWaitMicroseconds = 200;
+};
+
+struct MicroBatchStats {
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    uint64_t elements = 0;
+    // From enqueue() to the result being set, per request
+    double latencyP50Microseconds = 0.0;
+    double latencyP90Microseconds = 0.0;
+    double latencyP99Microseconds = 0.0;
+    double latencyMaxMicroseconds = 0.0;
+};
+
+// Coalesces many small jobs into one dispatch. enqueue() may be called from
+// any number of threads: it pushes the request onto a lock-free list and
+// returns a future for the output. A scheduler thread packs queued requests
+// back to back into the input buffer of a JobSlot, keeping a table of each
+// request's offset, and submits the batch once it holds maxBatchElements or
+// its oldest request has waited maxWaitMicroseconds. When the batch completes,
+// each request's range of the output resolves its future.
+//
+// compute_shader.comp works element by element, so a packed batch is simply a
+// longer job and the offsets table is only needed on the host. A request
+// larger than maxBatchElements is dispatched on its own. One batch is in
+// flight at a time, and as with AsyncCompute nothing else may use the
+// context's queue meanwhile.
+class MicroBatcher {
+public:
+    MicroBatcher(ComputeContext& context, const ComputeKernel& kernel, const MicroBatchOptions& options = MicroBatchOptions());
+    // Dispatches whatever is still queued, then stops the scheduler
+    ~MicroBatcher();
+
+    MicroBatcher(const MicroBatcher&) = delete;
+    MicroBatcher& operator=(const MicroBatcher&) = delete;
+
+    std::future<std::vector<uint32_t>> enqueue(std::vector<uint32_t> input);
+
+    uint32_t getMaxBatchElements() const { return maxBatchElements; }
+    uint32_t getMaxWaitMicroseconds() const { return static_cast<uint32_t>(maxWait.count()); }
+    MicroBatchStats getStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::vector<uint32_t> input;
+        std::promise<std::vector<uint32_t>> result;
+        Clock::time_point enqueueTime;
+        // The request pushed before this one, while on the lock-free list
+        Request* next = nullptr;
+    };
+
+    void schedulerLoop();
+    // Moves everything pushed since the last call to the back of pending
+    void takeQueued();
+    // Packs requests from the front of pending into one job and resolves them
+    void dispatchBatch();
+
+    ComputeContext& context;
+    JobSlot slot;
+    uint32_t maxBatchElements = 0;
+    std::chrono::microseconds maxWait;
+
+    // Producers push onto this list with a compare-and-swap. The scheduler
+    // only ever takes the whole list at once, so a node cannot be popped and
+    // pushed again under a producer (no ABA problem).
+    std::atomic<Request*> queueHead{ nullptr };
+    // Elements pushed and not yet taken; counted before the push, so it never
+    // falls below what is actually on the list
+    std::atomic<uint64_t> queuedElements{ 0 };
+    // Queued elements at which a producer has to wake the scheduler: 1 while
+    // it has nothing to do, the room left in the batch while it waits for the
+    // deadline
+    std::atomic<uint64_t> wakeThreshold{ 1 };
+    std::atomic<bool> stopping{ false };
+    // Only used to sleep and wake the scheduler; producers take it only when
+    // their request crosses wakeThreshold
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+
+    // Owned by the scheduler thread; oldest first
+    std::deque<std::unique_ptr<Request>> pending;
+    uint64_t pendingElements = 0;
+    std::vector<uint32_t> batchOffsets;
+
+    mutable std::mutex statsMutex;
+    uint64_t batchCount = 0;
+    uint64_t elementCount = 0;
+    std::vector<double> latencyMicroseconds;
+
+    std::thread schedulerThread;
+};
@@ -0,0 +1,76 @@
+#include "offload_dispatcher.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+
+OffloadDispatcher::OffloadDispatcher(ComputeKernel& gpuKernel, const CpuKernel& cpuKernel)
+    : gpuKernel(gpuKernel), cpuKernel(cpuKernel) {
+}
+
+template <typename Job>
+static double medianMicroseconds(Job job, uint32_t iterations) {
+    using Clock = std::chrono::steady_clock;
+
+    // One untimed run absorbs buffer growth and cold caches
+    job();
+    std::vector<double> samples(iterations);
+    for (uint32_t i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        job();
+        samples[i] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+uint32_t OffloadDispatcher::calibrate(uint32_t maxElements, uint32_t iterations) {
+    auto calibrationStart = std::chrono::steady_clock::now();
+    iterations = std::max(iterations, 1u);
+
+    std::vector<uint32_t> input(maxElements);
+    for (uint32_t i = 0; i < maxElements; ++i) {
+        input[i] = i;
+    }
+    std::vector<uint32_t> jobInput;
+    std::vector<uint32_t> output;
+
+    // The threshold is the start of the last run of sizes where the GPU wins,
+    // so a single noisy win at a small size does not move it
+    threshold = 0;
+    bool gpuWinning = false;
+    uint32_t lastSize = 0;
+    for (uint32_t elements = 256; elements <= maxElements; elements *= 4) {
+        jobInput.assign(input.begin(), input.begin() + elements);
+
+        const double cpuTime = medianMicroseconds([&] { cpuKernel.run(jobInput, output); }, iterations);
+        const double gpuTime = medianMicroseconds([&] { gpuKernel.run(jobInput, output); }, iterations);
+
+        if (gpuTime < cpuTime && !gpuWinning) {
+            threshold = elements;
+            gpuWinning = true;
+        }
+        else if (gpuTime >= cpuTime) {
+            gpuWinning = false;
+        }
+        lastSize = elements;
+    }
+    // The CPU won at every measured size: keep everything up to the largest
+    // measured size on the CPU and let bigger jobs go to the GPU
+    if (!gpuWinning) {
+        threshold = lastSize + 1;
+    }
+
+    auto calibrationEnd = std::chrono::steady_clock::now();
+    calibrationMilliseconds = std::chrono::duration<double, std::milli>(calibrationEnd - calibrationStart).count();
+    return threshold;
+}
+
+JobTarget OffloadDispatcher::run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
+    if (input.size() < threshold) {
+        cpuKernel.run(input, output);
+        return JobTarget::Cpu;
+    }
+    gpuKernel.run(input, output);
+    return JobTarget::Gpu;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "compute_kernel.hpp"
+#include "cpu_kernel.hpp"
+
+#include <vector>
+
+enum class JobTarget {
+    Cpu,
+    Gpu
+};
+
+// Routes each job to the CPU or the GPU kernel by size. Below the threshold
+// the fixed cost of a Vulkan submit and fence wait outweighs the work, so the
+// job runs on the host instead. The threshold comes from timing both engines
+// on the running machine.
+class OffloadDispatcher {
+public:
+    OffloadDispatcher(ComputeKernel& gpuKernel, const CpuKernel& cpuKernel);
+
+    // Times both engines on growing job sizes up to maxElements and sets the
+    // threshold to the smallest size from which the GPU stays faster
+    uint32_t calibrate(uint32_t maxElements = 1 << 22, uint32_t iterations = 5);
+    double getCalibrationMilliseconds() const { return calibrationMilliseconds; }
+
+    // Jobs with fewer elements than the threshold run on the CPU; 0 sends everything to the GPU
+    void setThreshold(uint32_t elements) { threshold = elements; }
+    uint32_t getThreshold() const { return threshold; }
+
+    JobTarget run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output);
+
+private:
+    ComputeKernel& gpuKernel;
+    const CpuKernel& cpuKernel;
+    uint32_t threshold = 0;
+    double calibrationMilliseconds = 0.0;
+};
@@ -0,0 +1,646 @@
+#include "parallel_primitives.hpp"
+#include "compute_kernel.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace {
+
+// Push constants of reduce.comp, scan.comp and radix_sort.comp
+struct ReduceParameters {
+    uint32_t count;
+    uint32_t op;
+    uint32_t isFloat;
+};
+
+struct ScanParameters {
+    uint32_t count;
+    uint32_t op;
+    uint32_t isFloat;
+    uint32_t mode;
+    uint32_t inclusive;
+};
+
+struct SortParameters {
+    uint32_t count;
+    uint32_t shift;
+    uint32_t mode;
+    uint32_t floatKeys;
+    uint32_t hasValues;
+    uint32_t blockCount;
+};
+
+// Modes of scan.comp and radix_sort.comp
+const uint32_t scanBlocksMode = 0;
+const uint32_t addBlockPrefixMode = 1;
+const uint32_t histogramMode = 0;
+const uint32_t scatterMode = 1;
+
+const uint32_t radixBits = 4;
+const uint32_t radix = 1u << radixBits;
+const uint32_t sortPasses = 32 / radixBits;
+
+// Every dispatch of a call takes one set from the pool. Even a sort of 2^30
+// keys needs only 8 * (2 + 5) of them at the default workgroup size.
+const uint32_t maxDispatchesPerCall = 256;
+const uint32_t maxBindings = 5;
+
+uint32_t divideRoundUp(uint32_t value, uint32_t divisor) {
+    return (value + divisor - 1) / divisor;
+}
+
+uint32_t roundDownToPowerOfTwo(uint32_t value) {
+    uint32_t result = 1;
+    while (result * 2 <= value) {
+        result *= 2;
+    }
+    return result;
+}
+
+// Matches identityValue() in primitive_ops.glsl
+uint32_t identityBits(PrimitiveOp op, bool isFloat) {
+    switch (op) {
+    case PrimitiveOp::Min:
+        return isFloat ? 0x7f800000u : 0xffffffffu;
+    case PrimitiveOp::Max:
+        return isFloat ? 0xff800000u : 0u;
+    default:
+        return 0u;
+    }
+}
+
+}
+
+const char* primitiveOpName(PrimitiveOp op) {
+    switch (op) {
+    case PrimitiveOp::Min:
+        return "min";
+    case PrimitiveOp::Max:
+        return "max";
+    default:
+        return "add";
+    }
+}
+
+ParallelPrimitives::ParallelPrimitives(ComputeContext& context, uint32_t requestedWorkgroupSize, bool allowSubgroups)
+    : context(context), transientArena(context, ArenaMode::Linear) {
+    ScopedPhase phase(context.getProfiler(), "primitives_setup");
+    VkDevice vulkanDevice = context.getDevice();
+
+    // Both shared-memory fallbacks halve or double a stride, so the sizes
+    // have to be powers of two
+    const uint32_t maxSize = ComputeKernel::maxWorkgroupSize(context.getDeviceProperties().limits);
+    const uint32_t workgroupSize = roundDownToPowerOfTwo(
+        std::min(requestedWorkgroupSize == 0 ? defaultWorkgroupSize : requestedWorkgroupSize, maxSize));
+    const uint32_t sortWorkgroupSize = std::max(std::min(workgroupSize, maxSortWorkgroupSize), radix);
+
+    useSubgroups = allowSubgroups && context.supportsSubgroupArithmetic();
+    createPipeline(reducePipeline, "reduce", 2, sizeof(ReduceParameters), workgroupSize);
+    createPipeline(scanPipeline, "scan", 3, sizeof(ScanParameters), workgroupSize);
+    createPipeline(sortPipeline, "radix_sort", 5, sizeof(SortParameters), sortWorkgroupSize);
+
+    VkDescriptorPoolSize descriptorPoolSize = {};
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSize.descriptorCount = maxDispatchesPerCall * maxBindings;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = maxDispatchesPerCall;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+
+    if (vkCreateDescriptorPool(vulkanDevice, &descriptorPoolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor pool");
+    }
+
+    VkCommandBufferAllocateInfo cmdBufferAllocateInfo = {};
+    cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufferAllocateInfo.commandPool = context.getCommandPool();
+    cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufferAllocateInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(vulkanDevice, &cmdBufferAllocateInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to allocate command buffers");
+    }
+
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if (vkCreateFence(vulkanDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create fence");
+    }
+
+    if (context.supportsTimestamps()) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = 2;
+
+        if (vkCreateQueryPool(vulkanDevice, &queryPoolCreateInfo, nullptr, &timestampQueryPool) != VK_SUCCESS) {
+            throw std::runtime_error("RUNTIME ERROR: Failed to create timestamp query pool");
+        }
+    }
+}
+
+ParallelPrimitives::~ParallelPrimitives() {
+    VkDevice vulkanDevice = context.getDevice();
+    vkDeviceWaitIdle(vulkanDevice);
+
+    endCall();
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(vulkanDevice, timestampQueryPool, nullptr);
+    }
+    vkDestroyFence(vulkanDevice, fence, nullptr);
+    vkFreeCommandBuffers(vulkanDevice, context.getCommandPool(), 1, &commandBuffer);
+    vkDestroyDescriptorPool(vulkanDevice, descriptorPool, nullptr);
+    destroyPipeline(sortPipeline);
+    destroyPipeline(scanPipeline);
+    destroyPipeline(reducePipeline);
+}
+
+void ParallelPrimitives::createPipeline(Pipeline& pipeline, const std::string& shaderName, uint32_t bindingCount,
+    uint32_t pushConstantSize, uint32_t workgroupSize) {
+    VkDevice vulkanDevice = context.getDevice();
+    pipeline.bindingCount = bindingCount;
+    pipeline.workgroupSize = workgroupSize;
+
+    // The subgroup variant is the same source built with -DUSE_SUBGROUPS
+    auto compShader = readFile(shaderName + (useSubgroups ? ".subgroup" : "") + ".comp.spv");
+
+    VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleCreateInfo.codeSize = compShader.size();
+    shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(compShader.data());
+
+    if (vkCreateShaderModule(vulkanDevice, &shaderModuleCreateInfo, nullptr, &pipeline.shaderModule) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create shader module");
+    }
+
+    // Create descriptor set layout
+    std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindings(bindingCount);
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = i;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags |= VK_SHADER_STAGE_COMPUTE_BIT;
+        descriptorSetLayoutBindings[i] = binding;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = bindingCount;
+    descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings.data();
+
+    if (vkCreateDescriptorSetLayout(vulkanDevice, &descriptorSetLayoutCreateInfo, nullptr, &pipeline.descriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create descriptor set layout");
+    }
+
+    // Create compute pipeline
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(vulkanDevice, &pipelineLayoutCreateInfo, nullptr, &pipeline.pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create pipeline layout");
+    }
+
+    // Only local_size_x is specialized; the shaders are one-dimensional
+    VkSpecializationMapEntry specializationMapEntry = {};
+    specializationMapEntry.constantID = 0;
+    specializationMapEntry.offset = 0;
+    specializationMapEntry.size = sizeof(uint32_t);
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &specializationMapEntry;
+    specializationInfo.dataSize = sizeof(uint32_t);
+    specializationInfo.pData = &pipeline.workgroupSize;
+
+    VkPipelineShaderStageCreateInfo pipelineShaderStageCreateInfo = {};
+    pipelineShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineShaderStageCreateInfo.pName = "main";
+    pipelineShaderStageCreateInfo.module = pipeline.shaderModule;
+    pipelineShaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.layout = pipeline.pipelineLayout;
+    computePipelineCreateInfo.stage = pipelineShaderStageCreateInfo;
+
+    if (vkCreateComputePipelines(vulkanDevice, context.getPipelineCache(), 1, &computePipelineCreateInfo, nullptr, &pipeline.pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to create compute pipeline");
+    }
+}
+
+void ParallelPrimitives::destroyPipeline(Pipeline& pipeline) {
+    VkDevice vulkanDevice = context.getDevice();
+    vkDestroyPipeline(vulkanDevice, pipeline.pipeline, nullptr);
+    vkDestroyPipelineLayout(vulkanDevice, pipeline.pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(vulkanDevice, pipeline.descriptorSetLayout, nullptr);
+    vkDestroyShaderModule(vulkanDevice, pipeline.shaderModule, nullptr);
+}
+
+ParallelPrimitives::Buffer& ParallelPrimitives::createHostBuffer(uint32_t elements, HostAccess access) {
+    callBuffers.emplace_back();
+    Buffer& buffer = callBuffers.back();
+    transientArena.createBuffer(std::max(elements, 1u) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        access, buffer.buffer, buffer.allocation);
+    return buffer;
+}
+
+ParallelPrimitives::Buffer& ParallelPrimitives::createDeviceBuffer(uint32_t elements) {
+    callBuffers.emplace_back();
+    Buffer& buffer = callBuffers.back();
+    transientArena.createBuffer(std::max(elements, 1u) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer.buffer, buffer.allocation);
+    return buffer;
+}
+
+void ParallelPrimitives::checkElementCount(size_t elements) const {
+    // Every buffer is bound whole, so it has to fit in one storage buffer range
+    const VkDeviceSize maxElements = context.getDeviceProperties().limits.maxStorageBufferRange / sizeof(uint32_t);
+    if (elements > maxElements || elements > UINT32_MAX) {
+        throw std::runtime_error("RUNTIME ERROR: " + std::to_string(elements) +
+            " elements exceed the storage buffer range of the device");
+    }
+}
+
+void ParallelPrimitives::beginCall() {
+    vkResetDescriptorPool(context.getDevice(), descriptorPool, 0);
+    vkResetCommandBuffer(commandBuffer, 0);
+    beginOneTimeCommandBuffer(commandBuffer);
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 0, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 0);
+    }
+    lastDispatchCount = 0;
+}
+
+void ParallelPrimitives::recordDispatch(const Pipeline& pipeline, const std::vector<VkBuffer>& buffers,
+    const void* parameters, uint32_t parametersSize, uint32_t invocations) {
+    VkDevice vulkanDevice = context.getDevice();
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = descriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+
+    VkDescriptorSet descriptorSet;
+    if (vkAllocateDescriptorSets(vulkanDevice, &descriptorSetAllocateInfo, &descriptorSet) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to allocate descriptor sets");
+    }
+
+    std::vector<VkDescriptorBufferInfo> bufferInfos(pipeline.bindingCount);
+    std::vector<VkWriteDescriptorSet> writeDescriptorSetVec(pipeline.bindingCount);
+    for (uint32_t i = 0; i < pipeline.bindingCount; i++) {
+        bufferInfos[i].buffer = buffers[i];
+        bufferInfos[i].offset = 0;
+        bufferInfos[i].range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet writeDescriptorSet = {};
+        writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptorSet.dstBinding = i;
+        writeDescriptorSet.dstArrayElement = 0;
+        writeDescriptorSet.descriptorCount = 1;
+        writeDescriptorSet.dstSet = descriptorSet;
+        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeDescriptorSet.pBufferInfo = &bufferInfos[i];
+        writeDescriptorSetVec[i] = writeDescriptorSet;
+    }
+
+    vkUpdateDescriptorSets(vulkanDevice, pipeline.bindingCount, writeDescriptorSetVec.data(), 0, nullptr);
+
+    uint32_t groupCountX = 0;
+    uint32_t groupCountY = 0;
+    dispatchGroupCounts(context.getDeviceProperties().limits, invocations, pipeline.workgroupSize, groupCountX, groupCountY);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, pipeline.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, parametersSize, parameters);
+    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+    lastDispatchCount++;
+
+    // Every pass reads what the one before it wrote, and some overwrite what
+    // an earlier pass still had to read
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void ParallelPrimitives::submitAndWait() {
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 1);
+    }
+    vkEndCommandBuffer(commandBuffer);
+
+    VkDevice vulkanDevice = context.getDevice();
+    vkResetFences(vulkanDevice, 1, &fence);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    auto submitStart = std::chrono::steady_clock::now();
+    if (vkQueueSubmit(context.getQueue(), 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("RUNTIME ERROR: Failed submit command buffer to queue");
+    }
+    vkWaitForFences(vulkanDevice, 1, &fence, true, UINT64_MAX);
+    lastSubmitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
+
+    lastGpuMilliseconds = 0.0;
+    uint64_t timestamps[2] = {};
+    if (timestampQueryPool != VK_NULL_HANDLE &&
+        vkGetQueryPoolResults(vulkanDevice, timestampQueryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS) {
+        // Masking the difference to the valid bits also handles a counter wrap
+        const uint32_t validBits = context.getTimestampValidBits();
+        const uint64_t mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+        const uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+        lastGpuMilliseconds = ticks * static_cast<double>(context.getDeviceProperties().limits.timestampPeriod) / 1e6;
+    }
+}
+
+void ParallelPrimitives::endCall() {
+    // The fence has been waited on, or nothing was submitted
+    for (Buffer& buffer : callBuffers) {
+        vkDestroyBuffer(context.getDevice(), buffer.buffer, nullptr);
+    }
+    callBuffers.clear();
+    transientArena.reset();
+}
+
+uint32_t ParallelPrimitives::reduce(const std::vector<uint32_t>& input, PrimitiveOp op) {
+    checkElementCount(input.size());
+    return reduceValues(input.data(), static_cast<uint32_t>(input.size()), op, false);
+}
+
+float ParallelPrimitives::reduce(const std::vector<float>& input, PrimitiveOp op) {
+    checkElementCount(input.size());
+    const uint32_t bits = reduceValues(input.data(), static_cast<uint32_t>(input.size()), op, true);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void ParallelPrimitives::scan(const std::vector<uint32_t>& input, std::vector<uint32_t>& output, PrimitiveOp op,
+    bool inclusive) {
+    checkElementCount(input.size());
+    output.resize(input.size());
+    scanValues(input.data(), output.data(), static_cast<uint32_t>(input.size()), op, false, inclusive);
+}
+
+void ParallelPrimitives::scan(const std::vector<float>& input, std::vector<float>& output, PrimitiveOp op,
+    bool inclusive) {
+    checkElementCount(input.size());
+    output.resize(input.size());
+    scanValues(input.data(), output.data(), static_cast<uint32_t>(input.size()), op, true, inclusive);
+}
+
+void ParallelPrimitives::sort(std::vector<uint32_t>& keys, std::vector<uint32_t>* values) {
+    checkElementCount(keys.size());
+    if (values != nullptr && values->size() != keys.size()) {
+        throw std::runtime_error("RUNTIME ERROR: Sort values must be as many as the keys");
+    }
+    sortValues(keys.data(), values != nullptr ? values->data() : nullptr, static_cast<uint32_t>(keys.size()), false);
+}
+
+void ParallelPrimitives::sort(std::vector<float>& keys, std::vector<uint32_t>* values) {
+    checkElementCount(keys.size());
+    if (values != nullptr && values->size() != keys.size()) {
+        throw std::runtime_error("RUNTIME ERROR: Sort values must be as many as the keys");
+    }
+    sortValues(keys.data(), values != nullptr ? values->data() : nullptr, static_cast<uint32_t>(keys.size()), true);
+}
+
+uint32_t ParallelPrimitives::reduceValues(const void* input, uint32_t count, PrimitiveOp op, bool isFloat) {
+    if (count == 0) {
+        // Nothing is dispatched; clear the stats so they do not describe the previous call
+        lastGpuMilliseconds = 0.0;
+        lastSubmitMilliseconds = 0.0;
+        lastDispatchCount = 0;
+        return identityBits(op, isFloat);
+    }
+
+    MemoryArena& arena = transientArena;
+    const uint32_t blockSize = reducePipeline.workgroupSize * itemsPerInvocation;
+    uint32_t result = 0;
+
+    beginCall();
+    try {
+        Buffer& inputBuffer = createHostBuffer(count, HostAccess::Upload);
+        memcpy(inputBuffer.allocation.mapped, input, count * sizeof(uint32_t));
+        arena.flush(inputBuffer.allocation, 0, count * sizeof(uint32_t));
+        Buffer& resultBuffer = createHostBuffer(1, HostAccess::Readback);
+
+        // Each pass leaves one value per block; they alternate between two
+        // scratch buffers until a single block remains, which writes the result
+        const uint32_t firstGroupCount = divideRoundUp(count, blockSize);
+        VkBuffer scratch[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+        if (firstGroupCount > 1) {
+            scratch[0] = createDeviceBuffer(firstGroupCount).buffer;
+            scratch[1] = createDeviceBuffer(divideRoundUp(firstGroupCount, blockSize)).buffer;
+        }
+
+        ReduceParameters parameters = {};
+        parameters.op = static_cast<uint32_t>(op);
+        parameters.isFloat = isFloat ? 1 : 0;
+
+        VkBuffer source = inputBuffer.buffer;
+        for (uint32_t pass = 0; ; pass++) {
+            const uint32_t groupCount = divideRoundUp(count, blockSize);
+            const VkBuffer destination = groupCount == 1 ? resultBuffer.buffer : scratch[pass % 2];
+            parameters.count = count;
+            recordDispatch(reducePipeline, { source, destination }, &parameters, sizeof(parameters),
+                groupCount * reducePipeline.workgroupSize);
+            if (groupCount == 1) {
+                break;
+            }
+            source = destination;
+            count = groupCount;
+        }
+
+        submitAndWait();
+        arena.invalidate(resultBuffer.allocation, 0, sizeof(uint32_t));
+        memcpy(&result, resultBuffer.allocation.mapped, sizeof(uint32_t));
+    }
+    catch (...) {
+        endCall();
+        throw;
+    }
+    endCall();
+    return result;
+}
+
+void ParallelPrimitives::recordScan(VkBuffer input, VkBuffer output, uint32_t count, PrimitiveOp op, bool isFloat,
+    bool inclusive, std::vector<VkBuffer>& levels) {
+    const uint32_t blockSize = scanPipeline.workgroupSize * itemsPerInvocation;
+
+    // Level i scans levelCounts[i] values and writes its block totals to
+    // levels[i]; the block totals of one level are the values of the next,
+    // up to a level that fits in a single block
+    std::vector<uint32_t> levelCounts = { count };
+    while (levelCounts.back() > blockSize) {
+        levelCounts.push_back(divideRoundUp(levelCounts.back(), blockSize));
+    }
+    if (levels.empty()) {
+        for (uint32_t levelCount : levelCounts) {
+            levels.push_back(createDeviceBuffer(divideRoundUp(levelCount, blockSize)).buffer);
+        }
+    }
+
+    ScanParameters parameters = {};
+    parameters.op = static_cast<uint32_t>(op);
+    parameters.isFloat = isFloat ? 1 : 0;
+
+    // Up: scan every level's blocks. Only the first level is the caller's
+    // scan; the block totals above it are scanned exclusively in place.
+    parameters.mode = scanBlocksMode;
+    for (size_t level = 0; level < levelCounts.size(); level++) {
+        const VkBuffer values = level == 0 ? output : levels[level - 1];
+        parameters.count = levelCounts[level];
+        parameters.inclusive = level == 0 && inclusive ? 1 : 0;
+        recordDispatch(scanPipeline, { level == 0 ? input : values, values, levels[level] }, &parameters,
+            sizeof(parameters), divideRoundUp(levelCounts[level], blockSize) * scanPipeline.workgroupSize);
+    }
+
+    // Down: each level's scanned block totals are now final, so combining
+    // them into the level below finishes that one too
+    parameters.mode = addBlockPrefixMode;
+    parameters.inclusive = 0;
+    for (size_t level = levelCounts.size() - 1; level-- > 0; ) {
+        const VkBuffer values = level == 0 ? output : levels[level - 1];
+        parameters.count = levelCounts[level];
+        recordDispatch(scanPipeline, { values, values, levels[level] }, &parameters, sizeof(parameters),
+            levelCounts[level]);
+    }
+}
+
+void ParallelPrimitives::scanValues(const void* input, void* output, uint32_t count, PrimitiveOp op, bool isFloat,
+    bool inclusive) {
+    if (count == 0) {
+        lastGpuMilliseconds = 0.0;
+        lastSubmitMilliseconds = 0.0;
+        lastDispatchCount = 0;
+        return;
+    }
+
+    MemoryArena& arena = transientArena;
+
+    beginCall();
+    try {
+        Buffer& inputBuffer = createHostBuffer(count, HostAccess::Upload);
+        memcpy(inputBuffer.allocation.mapped, input, count * sizeof(uint32_t));
+        arena.flush(inputBuffer.allocation, 0, count * sizeof(uint32_t));
+        Buffer& outputBuffer = createHostBuffer(count, HostAccess::Readback);
+
+        std::vector<VkBuffer> levels;
+        recordScan(inputBuffer.buffer, outputBuffer.buffer, count, op, isFloat, inclusive, levels);
+
+        submitAndWait();
+        arena.invalidate(outputBuffer.allocation, 0, count * sizeof(uint32_t));
+        memcpy(output, outputBuffer.allocation.mapped, count * sizeof(uint32_t));
+    }
+    catch (...) {
+        endCall();
+        throw;
+    }
+    endCall();
+}
+
+void ParallelPrimitives::sortValues(void* keys, uint32_t* values, uint32_t count, bool floatKeys) {
+    if (count <= 1) {
+        lastGpuMilliseconds = 0.0;
+        lastSubmitMilliseconds = 0.0;
+        lastDispatchCount = 0;
+        return;
+    }
+
+    MemoryArena& arena = transientArena;
+    const bool hasValues = values != nullptr;
+    const uint32_t blockCount = divideRoundUp(count, sortPipeline.workgroupSize);
+    const VkDeviceSize bytes = count * sizeof(uint32_t);
+
+    beginCall();
+    try {
+        Buffer& keysUpload = createHostBuffer(count, HostAccess::Upload);
+        memcpy(keysUpload.allocation.mapped, keys, bytes);
+        arena.flush(keysUpload.allocation, 0, bytes);
+        Buffer& keysReadback = createHostBuffer(count, HostAccess::Readback);
+        const VkBuffer keysTemp[2] = { createDeviceBuffer(count).buffer, createDeviceBuffer(count).buffer };
+
+        // Without values the key buffers stand in for the value bindings,
+        // which the shader then never touches
+        VkBuffer valuesUpload = keysUpload.buffer;
+        VkBuffer valuesReadback = keysReadback.buffer;
+        VkBuffer valuesTemp[2] = { keysTemp[0], keysTemp[1] };
+        Buffer* valuesReadbackBuffer = nullptr;
+        if (hasValues) {
+            Buffer& upload = createHostBuffer(count, HostAccess::Upload);
+            memcpy(upload.allocation.mapped, values, bytes);
+            arena.flush(upload.allocation, 0, bytes);
+            valuesReadbackBuffer = &createHostBuffer(count, HostAccess::Readback);
+            valuesUpload = upload.buffer;
+            valuesReadback = valuesReadbackBuffer->buffer;
+            valuesTemp[0] = createDeviceBuffer(count).buffer;
+            valuesTemp[1] = createDeviceBuffer(count).buffer;
+        }
+
+        const uint32_t offsetCount = radix * blockCount;
+        const VkBuffer offsets = createDeviceBuffer(offsetCount).buffer;
+        std::vector<VkBuffer> scanLevels;
+
+        SortParameters parameters = {};
+        parameters.count = count;
+        parameters.floatKeys = floatKeys ? 1 : 0;
+        parameters.hasValues = hasValues ? 1 : 0;
+        parameters.blockCount = blockCount;
+
+        // The first pass reads the uploaded data and the last one writes the
+        // readback buffers; the passes in between ping-pong in device memory
+        for (uint32_t pass = 0; pass < sortPasses; pass++) {
+            const VkBuffer keysIn = pass == 0 ? keysUpload.buffer : keysTemp[(pass - 1) % 2];
+            const VkBuffer valuesIn = pass == 0 ? valuesUpload : valuesTemp[(pass - 1) % 2];
+            const VkBuffer keysOut = pass + 1 == sortPasses ? keysReadback.buffer : keysTemp[pass % 2];
+            const VkBuffer valuesOut = pass + 1 == sortPasses ? valuesReadback : valuesTemp[pass % 2];
+            const std::vector<VkBuffer> buffers = { keysIn, valuesIn, keysOut, valuesOut, offsets };
+            parameters.shift = pass * radixBits;
+
+            parameters.mode = histogramMode;
+            recordDispatch(sortPipeline, buffers, &parameters, sizeof(parameters), count);
+            recordScan(offsets, offsets, offsetCount, PrimitiveOp::Add, false, false, scanLevels);
+            parameters.mode = scatterMode;
+            recordDispatch(sortPipeline, buffers, &parameters, sizeof(parameters), count);
+        }
+
+        submitAndWait();
+        arena.invalidate(keysReadback.allocation, 0, bytes);
+        memcpy(keys, keysReadback.allocation.mapped, bytes);
+        if (hasValues) {
+            arena.invalidate(valuesReadbackBuffer->allocation, 0, bytes);
+            memcpy(values, valuesReadbackBuffer->allocation.mapped, bytes);
+        }
+    }
+    catch (...) {
+        endCall();
+        throw;
+    }
+    endCall();
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "memory_arena.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+enum class PrimitiveOp {
+    Add,
+    Min,
+    Max
+};
+
+const char* primitiveOpName(PrimitiveOp op);
+
+// Reductions, prefix scans and a stable key-value radix sort on uint32 and
+// float buffers (reduce.comp, scan.comp and radix_sort.comp). Each workgroup
+// works on a block in shared memory, and inputs of any size are handled by
+// running the shaders again over the per-block results:
+//
+// - reduce folds every block to one value, then the block values, until a
+//   single value is left
+// - scan scans every block and writes its total, scans the totals the same
+//   way, then adds each block's scanned total back into its elements
+// - sort makes eight 4-bit passes; each counts the digits per block, scans
+//   those counts with scan.comp and scatters every element to its place
+//
+// When the device supports subgroup arithmetic the SPIR-V built with
+// -DUSE_SUBGROUPS is loaded instead, which does the in-workgroup steps with
+// subgroup operations and needs shared memory only across subgroups.
+//
+// Every call records all of its passes into one command buffer, with a
+// barrier between dependent dispatches and timestamps around them when the
+// queue supports it, and waits for it. Inputs and outputs
+// are staged through host-visible buffers; intermediates stay in device-local
+// memory. All of them come from a Linear arena that is reset after each call.
+// Float sums depend on the order of the additions, so they can differ from a
+// serial sum in the last bits.
+class ParallelPrimitives {
+public:
+    // Elements each reduce or scan invocation combines; must match
+    // ITEMS_PER_INVOCATION in reduce.comp and scan.comp
+    static constexpr uint32_t itemsPerInvocation = 4;
+    // The 8-bit rank fields of radix_sort.comp limit its workgroups to this
+    static constexpr uint32_t maxSortWorkgroupSize = 128;
+    static constexpr uint32_t defaultWorkgroupSize = 256;
+
+    // workgroupSize 0 uses defaultWorkgroupSize; it is rounded down to a power
+    // of two within the device limits. allowSubgroups false keeps the
+    // shared-memory shaders even on devices with subgroup arithmetic.
+    ParallelPrimitives(ComputeContext& context, uint32_t workgroupSize = 0, bool allowSubgroups = true);
+    ~ParallelPrimitives();
+
+    ParallelPrimitives(const ParallelPrimitives&) = delete;
+    ParallelPrimitives& operator=(const ParallelPrimitives&) = delete;
+
+    // The identity of op for an empty input
+    uint32_t reduce(const std::vector<uint32_t>& input, PrimitiveOp op);
+    float reduce(const std::vector<float>& input, PrimitiveOp op);
+    // Exclusive scans start at the identity of op (0, the maximum or the
+    // minimum of the type, or +-inf for floats)
+    void scan(const std::vector<uint32_t>& input, std::vector<uint32_t>& output, PrimitiveOp op, bool inclusive);
+    void scan(const std::vector<float>& input, std::vector<float>& output, PrimitiveOp op, bool inclusive);
+    // Stable ascending sort. values, when given, must be as long as keys and
+    // is permuted along with them.
+    void sort(std::vector<uint32_t>& keys, std::vector<uint32_t>* values = nullptr);
+    void sort(std::vector<float>& keys, std::vector<uint32_t>* values = nullptr);
+
+    bool usesSubgroups() const { return useSubgroups; }
+    uint32_t getWorkgroupSize() const { return scanPipeline.workgroupSize; }
+    uint32_t getSortWorkgroupSize() const { return sortPipeline.workgroupSize; }
+    // False when the queue has no timestamps; only the submit time is known then
+    bool hasGpuTimestamps() const { return timestampQueryPool != VK_NULL_HANDLE; }
+    // Device time between timestamps before the first and after the last pass
+    // of the last call
+    double getLastGpuMilliseconds() const { return lastGpuMilliseconds; }
+    // Host time from submit to fence of the last call, which adds submission
+    // and wake-up latency to the passes but not the host copies
+    double getLastSubmitMilliseconds() const { return lastSubmitMilliseconds; }
+    // Dispatches recorded by the last call
+    uint32_t getLastDispatchCount() const { return lastDispatchCount; }
+
+private:
+    struct Pipeline {
+        VkShaderModule shaderModule = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        uint32_t bindingCount = 0;
+        uint32_t workgroupSize = 0;
+    };
+
+    struct Buffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        ArenaAllocation allocation;
+    };
+
+    void createPipeline(Pipeline& pipeline, const std::string& shaderName, uint32_t bindingCount,
+        uint32_t pushConstantSize, uint32_t workgroupSize);
+    void destroyPipeline(Pipeline& pipeline);
+
+    // Buffers live for one call and are released together by endCall()
+    Buffer& createHostBuffer(uint32_t elements, HostAccess access);
+    Buffer& createDeviceBuffer(uint32_t elements);
+    void checkElementCount(size_t elements) const;
+
+    void beginCall();
+    // Binds the buffers to consecutive bindings, pushes the parameters and
+    // dispatches enough workgroups for invocations, then adds a barrier
+    void recordDispatch(const Pipeline& pipeline, const std::vector<VkBuffer>& buffers, const void* parameters,
+        uint32_t parametersSize, uint32_t invocations);
+    void submitAndWait();
+    void endCall();
+
+    // The shared implementations work on raw 32-bit values
+    uint32_t reduceValues(const void* input, uint32_t count, PrimitiveOp op, bool isFloat);
+    void scanValues(const void* input, void* output, uint32_t count, PrimitiveOp op, bool isFloat, bool inclusive);
+    void sortValues(void* keys, uint32_t* values, uint32_t count, bool floatKeys);
+    // Records a multi-level scan of count values from input into output (which
+    // may be the same buffer). levels holds the per-level block totals; it is
+    // filled on first use and can be passed again for scans of the same size.
+    void recordScan(VkBuffer input, VkBuffer output, uint32_t count, PrimitiveOp op, bool isFloat, bool inclusive,
+        std::vector<VkBuffer>& levels);
+
+    ComputeContext& context;
+    bool useSubgroups = false;
+    Pipeline reducePipeline;
+    Pipeline scanPipeline;
+    Pipeline sortPipeline;
+
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    // Per-call buffers are bump-allocated and released with one reset(), so
+    // after the first few calls no call allocates device memory
+    MemoryArena transientArena;
+    // A deque, so references handed out stay valid as buffers are added
+    std::deque<Buffer> callBuffers;
+
+    double lastGpuMilliseconds = 0.0;
+    double lastSubmitMilliseconds = 0.0;
+    uint32_t lastDispatchCount = 0;
+};
@@ -0,0 +1,74 @@
+// Operators shared by reduce.comp and scan.comp. Values are stored as uint;
+// when params.isFloat is set they are reinterpreted as IEEE floats. Both
+// shaders declare params.op and params.isFloat before including this file.
+
+const uint OP_ADD = 0;
+const uint OP_MIN = 1;
+const uint OP_MAX = 2;
+
+uint identityValue() {
+    if (params.op == OP_ADD) {
+        return 0u;
+    }
+    if (params.op == OP_MIN) {
+        // +inf for floats
+        return params.isFloat != 0 ? 0x7f800000u : 0xffffffffu;
+    }
+    // -inf for floats
+    return params.isFloat != 0 ? 0xff800000u : 0u;
+}
+
+uint combine(uint a, uint b) {
+    if (params.isFloat != 0) {
+        float x = uintBitsToFloat(a);
+        float y = uintBitsToFloat(b);
+        if (params.op == OP_ADD) {
+            return floatBitsToUint(x + y);
+        }
+        return floatBitsToUint(params.op == OP_MIN ? min(x, y) : max(x, y));
+    }
+    if (params.op == OP_ADD) {
+        return a + b;
+    }
+    return params.op == OP_MIN ? min(a, b) : max(a, b);
+}
+
+#ifdef USE_SUBGROUPS
+// params is uniform, so every branch below is taken by the whole subgroup
+
+uint subgroupCombine(uint value) {
+    if (params.isFloat != 0) {
+        float x = uintBitsToFloat(value);
+        if (params.op == OP_ADD) {
+            return floatBitsToUint(subgroupAdd(x));
+        }
+        return floatBitsToUint(params.op == OP_MIN ? subgroupMin(x) : subgroupMax(x));
+    }
+    if (params.op == OP_ADD) {
+        return subgroupAdd(value);
+    }
+    return params.op == OP_MIN ? subgroupMin(value) : subgroupMax(value);
+}
+
+uint subgroupExclusiveCombine(uint value) {
+    // The first active lane gets identityValue() explicitly, so its result
+    // matches the shared-memory path bit for bit
+    uint result;
+    if (params.isFloat != 0) {
+        float x = uintBitsToFloat(value);
+        if (params.op == OP_ADD) {
+            result = floatBitsToUint(subgroupExclusiveAdd(x));
+        }
+        else {
+            result = floatBitsToUint(params.op == OP_MIN ? subgroupExclusiveMin(x) : subgroupExclusiveMax(x));
+        }
+    }
+    else if (params.op == OP_ADD) {
+        result = subgroupExclusiveAdd(value);
+    }
+    else {
+        result = params.op == OP_MIN ? subgroupExclusiveMin(value) : subgroupExclusiveMax(value);
+    }
+    return subgroupElect() ? identityValue() : result;
+}
+#endif
@@ -0,0 +1,105 @@
+#include "profiler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+
+static const char* phaseClockName(PhaseClock clock) {
+    return clock == PhaseClock::Gpu ? "gpu" : "host";
+}
+
+void Profiler::record(const std::string& phase, double milliseconds, PhaseClock clock) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = std::find_if(phases.begin(), phases.end(), [&](const PhaseStats& stats) {
+        return stats.name == phase && stats.clock == clock;
+    });
+    if (it == phases.end()) {
+        PhaseStats stats;
+        stats.name = phase;
+        stats.clock = clock;
+        stats.minMilliseconds = milliseconds;
+        stats.maxMilliseconds = milliseconds;
+        phases.push_back(stats);
+        it = phases.end() - 1;
+    }
+
+    it->count++;
+    it->totalMilliseconds += milliseconds;
+    it->minMilliseconds = std::min(it->minMilliseconds, milliseconds);
+    it->maxMilliseconds = std::max(it->maxMilliseconds, milliseconds);
+}
+
+void Profiler::setInfo(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto& entry : info) {
+        if (entry.first == key) {
+            entry.second = value;
+            return;
+        }
+    }
+    info.emplace_back(key, value);
+}
+
+std::vector<PhaseStats> Profiler::getPhases() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return phases;
+}
+
+void Profiler::writeJson(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    out << "{\n    \"info\": {";
+    for (size_t i = 0; i < info.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n") << "        \"" << jsonEscape(info[i].first) << "\": \"" <<
+            jsonEscape(info[i].second) << "\"";
+    }
+    out << "\n    },\n    \"phases\": [";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const PhaseStats& stats = phases[i];
+        out << (i == 0 ? "\n" : ",\n") << "        { \"name\": \"" << jsonEscape(stats.name) <<
+            "\", \"clock\": \"" << phaseClockName(stats.clock) <<
+            "\", \"count\": " << stats.count <<
+            ", \"total_ms\": " << stats.totalMilliseconds <<
+            ", \"mean_ms\": " << stats.totalMilliseconds / stats.count <<
+            ", \"min_ms\": " << stats.minMilliseconds <<
+            ", \"max_ms\": " << stats.maxMilliseconds << " }";
+    }
+    out << "\n    ]\n}\n";
+}
+
+void Profiler::writeCsv(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Info values are repeated on every row so each row stands on its own in a dashboard
+    for (const auto& entry : info) {
+        out << csvEscape(entry.first) << ",";
+    }
+    out << "phase,clock,count,total_ms,mean_ms,min_ms,max_ms\n";
+
+    for (const PhaseStats& stats : phases) {
+        for (const auto& entry : info) {
+            out << csvEscape(entry.second) << ",";
+        }
+        out << csvEscape(stats.name) << "," << phaseClockName(stats.clock) << "," << stats.count << "," <<
+            stats.totalMilliseconds << "," << stats.totalMilliseconds / stats.count << "," <<
+            stats.minMilliseconds << "," << stats.maxMilliseconds << "\n";
+    }
+}
+
+void Profiler::writeFile(const std::string& filepath) const {
+    std::ofstream file(filepath, std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to open " + filepath);
+    }
+
+    if (endsWith(filepath, ".csv")) {
+        writeCsv(file);
+    }
+    else {
+        writeJson(file);
+    }
+}
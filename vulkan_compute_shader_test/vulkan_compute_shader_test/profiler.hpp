@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Where a phase was measured: on the host with steady_clock, or on the GPU
+// with timestamp queries
+enum class PhaseClock {
+    Host,
+    Gpu
+};
+
+struct PhaseStats {
+    std::string name;
+    PhaseClock clock = PhaseClock::Host;
+    uint32_t count = 0;
+    double totalMilliseconds = 0.0;
+    double minMilliseconds = 0.0;
+    double maxMilliseconds = 0.0;
+};
+
+// Collects named timing samples from setup and per-job phases and writes them
+// as JSON or CSV. Phases keep the order they were first recorded in, and
+// repeated samples of the same phase are aggregated.
+class Profiler {
+public:
+    void record(const std::string& phase, double milliseconds, PhaseClock clock = PhaseClock::Host);
+    // Key/value pairs written with every report, e.g. device name and driver version
+    void setInfo(const std::string& key, const std::string& value);
+
+    std::vector<PhaseStats> getPhases() const;
+
+    void writeJson(std::ostream& out) const;
+    void writeCsv(std::ostream& out) const;
+    // Picks CSV for *.csv paths and JSON otherwise
+    void writeFile(const std::string& filepath) const;
+
+private:
+    std::vector<PhaseStats> phases;
+    std::vector<std::pair<std::string, std::string>> info;
+    mutable std::mutex mutex;
+};
+
+// Records the time between construction and destruction as a host phase.
+// A null profiler turns it into a no-op.
+class ScopedPhase {
+public:
+    ScopedPhase(Profiler* profiler, const char* phase)
+        : profiler(profiler), phase(phase), start(std::chrono::steady_clock::now()) {}
+    ~ScopedPhase() {
+        if (profiler != nullptr) {
+            auto end = std::chrono::steady_clock::now();
+            profiler->record(phase, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+    }
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+private:
+    Profiler* profiler;
+    const char* phase;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,106 @@
+#include "stream_runner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+
+StreamRunner::StreamRunner(ComputeContext& context, const ComputeKernel& kernel, const StreamOptions& options)
+    : context(context), kernel(kernel) {
+    const uint32_t maxChunkElements = context.getDeviceProperties().limits.maxStorageBufferRange / sizeof(uint32_t);
+    chunkElements = std::min(std::max(options.chunkElements, 1u), maxChunkElements);
+    if (chunkElements < options.chunkElements) {
+        std::cout << "Chunk size clamped to " << chunkElements << " elements (maxStorageBufferRange)" << std::endl;
+    }
+
+    slots.resize(std::min(std::max(options.slotCount, 1u), maxSlotCount));
+    for (Slot& slot : slots) {
+        slot.job = std::make_unique<JobSlot>(context, kernel);
+        slot.job->reserve(chunkElements);
+    }
+}
+
+StreamRunner::~StreamRunner() {
+    vkDeviceWaitIdle(context.getDevice());
+}
+
+StreamStats StreamRunner::run(std::istream& input, std::ostream& output) {
+    const size_t chunkBytes = static_cast<size_t>(chunkElements) * sizeof(uint32_t);
+
+    StreamStats stats;
+    auto streamStart = std::chrono::steady_clock::now();
+
+    size_t next = 0;
+    bool endOfInput = false;
+    while (!endOfInput) {
+        Slot& slot = slots[next];
+
+        // The slot's previous chunk is the oldest one in flight, so retiring it
+        // here keeps the output in input order
+        if (slot.inFlight) {
+            stats.bytesWritten += retire(slot, output);
+        }
+
+        // Read the next chunk straight into mapped memory while the GPU works on
+        // the chunks already submitted from the other slots
+        char* uploadData = static_cast<char*>(slot.job->getUploadData());
+
+        input.read(uploadData, chunkBytes);
+        size_t bytesRead = static_cast<size_t>(input.gcount());
+        endOfInput = bytesRead < chunkBytes;
+        stats.bytesRead += bytesRead;
+
+        if (bytesRead % sizeof(uint32_t) != 0) {
+            // Zero-pad a trailing partial element rather than dropping it
+            const size_t padding = sizeof(uint32_t) - bytesRead % sizeof(uint32_t);
+            memset(uploadData + bytesRead, 0, padding);
+            bytesRead += padding;
+            std::cerr << "Input length is not a multiple of 4 bytes; last element zero-padded" << std::endl;
+        }
+
+        const uint32_t elements = static_cast<uint32_t>(bytesRead / sizeof(uint32_t));
+        if (elements == 0) {
+            break;
+        }
+
+        slot.job->submit(elements);
+        slot.pendingElements = elements;
+        slot.inFlight = true;
+
+        stats.elements += elements;
+        stats.chunks++;
+        next = (next + 1) % slots.size();
+    }
+
+    // Drain the remaining chunks, oldest first
+    for (size_t i = 0; i < slots.size(); ++i) {
+        Slot& slot = slots[(next + i) % slots.size()];
+        if (slot.inFlight) {
+            stats.bytesWritten += retire(slot, output);
+        }
+    }
+    output.flush();
+
+    auto streamEnd = std::chrono::steady_clock::now();
+    stats.seconds = std::chrono::duration<double>(streamEnd - streamStart).count();
+    if (stats.seconds > 0.0) {
+        stats.gigabytesPerSecond = (stats.bytesRead + stats.bytesWritten) / stats.seconds / 1e9;
+    }
+
+    if (!output) {
+        throw std::runtime_error("RUNTIME ERROR: Failed to write stream output");
+    }
+
+    return stats;
+}
+
+uint64_t StreamRunner::retire(Slot& slot, std::ostream& output) {
+    slot.job->wait();
+    slot.inFlight = false;
+
+    const size_t bytes = static_cast<size_t>(slot.pendingElements) * sizeof(uint32_t);
+    output.write(static_cast<const char*>(slot.job->getReadbackData(slot.pendingElements)), bytes);
+    return bytes;
+}
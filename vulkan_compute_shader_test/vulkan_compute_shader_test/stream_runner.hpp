@@ -0,0 +1,67 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "compute_kernel.hpp"
+#include "job_slot.hpp"
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+struct StreamOptions {
+    // Elements per chunk; clamped so a chunk never exceeds maxStorageBufferRange
+    uint32_t chunkElements = 1 << 22;
+    // Chunks in flight at once: 2 for double buffering, 3 for triple buffering
+    uint32_t slotCount = 3;
+};
+
+struct StreamStats {
+    uint64_t elements = 0;
+    uint32_t chunks = 0;
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    double seconds = 0.0;
+    // (bytesRead + bytesWritten) / seconds, in 10^9 bytes per second
+    double gigabytesPerSecond = 0.0;
+};
+
+// Pushes an input stream of little-endian uint32 values through a kernel in
+// fixed-size chunks. Every slot is a JobSlot with its own buffers, descriptor
+// set, command buffers and fence, so while the GPU works on chunk i the host
+// is already reading chunk i+1 into the next slot, and the results of chunk
+// i-N+1 are written out as soon as its fence signals. Output is written in input order.
+//
+// The kernel's pipeline is shared; its own buffers and descriptor set are not
+// touched, so kernel.run() can still be used alongside a StreamRunner.
+class StreamRunner {
+public:
+    static constexpr uint32_t maxSlotCount = 8;
+
+    StreamRunner(ComputeContext& context, const ComputeKernel& kernel, const StreamOptions& options = StreamOptions());
+    ~StreamRunner();
+
+    StreamRunner(const StreamRunner&) = delete;
+    StreamRunner& operator=(const StreamRunner&) = delete;
+
+    StreamStats run(std::istream& input, std::ostream& output);
+
+    uint32_t getChunkElements() const { return chunkElements; }
+    uint32_t getSlotCount() const { return static_cast<uint32_t>(slots.size()); }
+
+private:
+    // The GPU side lives in the JobSlot; this tracks the chunk it is working on
+    struct Slot {
+        std::unique_ptr<JobSlot> job;
+        uint32_t pendingElements = 0;
+        bool inFlight = false;
+    };
+
+    // Waits for the slot's chunk and writes its results; returns the bytes written
+    uint64_t retire(Slot& slot, std::ostream& output);
+
+    ComputeContext& context;
+    const ComputeKernel& kernel;
+    uint32_t chunkElements = 0;
+    std::vector<Slot> slots;
+};
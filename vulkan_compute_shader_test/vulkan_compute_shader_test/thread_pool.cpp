@@ -0,0 +1,104 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <exception>
+
+
+ThreadPool::ThreadPool(uint32_t concurrency) {
+    if (concurrency == 0) {
+        concurrency = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (uint32_t i = 1; i < concurrency; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop() {
+    for (;;) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            // Drain the queue before exiting so no submitted future is left unsatisfied
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+    std::packaged_task<void()> packagedTask(std::move(task));
+    std::future<void> future = packagedTask.get_future();
+
+    if (workers.empty()) {
+        packagedTask();
+        return future;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(packagedTask));
+    }
+    condition.notify_one();
+    return future;
+}
+
+void ThreadPool::parallelFor(size_t count, size_t minRangeSize, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+
+    const size_t maxRanges = (count + std::max<size_t>(minRangeSize, 1) - 1) / std::max<size_t>(minRangeSize, 1);
+    const size_t rangeCount = std::min<size_t>(getConcurrency(), maxRanges);
+    if (rangeCount <= 1) {
+        body(0, count);
+        return;
+    }
+
+    const size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+    std::vector<std::future<void>> futures;
+    for (size_t begin = rangeSize; begin < count; begin += rangeSize) {
+        const size_t end = std::min(begin + rangeSize, count);
+        futures.push_back(submit([&body, begin, end] { body(begin, end); }));
+    }
+
+    // The first range runs on the calling thread. Every future is waited on
+    // before anything is rethrown, since the tasks reference body.
+    std::exception_ptr error;
+    try {
+        body(0, std::min(rangeSize, count));
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    for (std::future<void>& future : futures) {
+        try {
+            future.get();
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed from a shared task queue. Used by the CPU
+// kernel to split large jobs; the calling thread always takes a share of the
+// work itself, so a pool with zero workers degrades to serial execution.
+class ThreadPool {
+public:
+    // concurrency counts the calling thread; 0 uses std::thread::hardware_concurrency()
+    explicit ThreadPool(uint32_t concurrency = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::future<void> submit(std::function<void()> task);
+
+    // Calls body(begin, end) on disjoint ranges covering [0, count), with at
+    // least minRangeSize items per range, and returns when all have finished
+    void parallelFor(size_t count, size_t minRangeSize, const std::function<void(size_t, size_t)>& body);
+
+    // Workers plus the calling thread
+    uint32_t getConcurrency() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
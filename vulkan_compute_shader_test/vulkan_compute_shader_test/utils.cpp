@@ -0,0 +1,111 @@
+#include "utils.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+
+std::vector<char> readFile(const std::string& filepath) {
+    std::ifstream file{ filepath, std::ios::ate | std::ios::binary };
+
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file: " + filepath);
+    }
+
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    std::vector<char> buffer(fileSize);
+    file.seekg(0);
+    file.read(buffer.data(), fileSize);
+    file.close();
+
+    return buffer;
+}
+
+uint64_t hashBytes(const std::vector<char>& data) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::vector<std::string> splitList(const std::string& list, char separator) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(separator, start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > start) {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Escapes quotes, backslashes and control characters for JSON strings
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        switch (c) {
+        case '"':
+            escaped += "\\\"";
+            break;
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) >= 0x20) {
+                escaped += c;
+            }
+            break;
+        }
+    }
+    return escaped;
+}
+
+// Quotes a CSV field when it contains a separator or a quote
+std::string csvEscape(const std::string& text) {
+    if (text.find_first_of(",\"\n") == std::string::npos) {
+        return text;
+    }
+    std::string escaped = "\"";
+    for (char c : text) {
+        if (c == '"') {
+            escaped += '"';
+        }
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+bool getEnvironmentVariable(const char* name, std::string& value) {
+#ifdef _WIN32
+    // getenv is deprecated under the SDL checks, so use the _s variant
+    char* buffer = nullptr;
+    size_t length = 0;
+    if (_dupenv_s(&buffer, &length, name) != 0 || buffer == nullptr) {
+        return false;
+    }
+    value = buffer;
+    free(buffer);
+    return true;
+#else
+    const char* buffer = std::getenv(name);
+    if (buffer == nullptr) {
+        return false;
+    }
+    value = buffer;
+    return true;
+#endif
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+std::vector<char> readFile(const std::string& filepath);
+// 64-bit FNV-1a hash of data
+uint64_t hashBytes(const std::vector<char>& data);
+// Splits "a,b,c" into its non-empty items
+std::vector<std::string> splitList(const std::string& list, char separator = ',');
+bool endsWith(const std::string& text, const std::string& suffix);
+// Escapes text for use inside a JSON string literal
+std::string jsonEscape(const std::string& text);
+// Quotes a CSV field when needed
+std::string csvEscape(const std::string& text);
+// Reads an environment variable; returns false when it is unset
+bool getEnvironmentVariable(const char* name, std::string& value);
@@ -0,0 +1,119 @@
+#include "work_partitioner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+
+WorkPartitioner::WorkPartitioner(const std::vector<PartitionTarget>& partitionTargets) {
+    if (partitionTargets.empty()) {
+        throw std::runtime_error("RUNTIME ERROR: Work partitioner needs at least one target");
+    }
+
+    for (const PartitionTarget& partitionTarget : partitionTargets) {
+        Target target;
+        target.target = partitionTarget;
+        target.slot = std::make_unique<JobSlot>(*partitionTarget.context, *partitionTarget.kernel, partitionTarget.queueIndex);
+        target.maxElements = partitionTarget.context->getDeviceProperties().limits.maxStorageBufferRange / sizeof(uint32_t);
+        targets.push_back(std::move(target));
+    }
+}
+
+WorkPartitioner::~WorkPartitioner() {
+    for (const Target& target : targets) {
+        vkDeviceWaitIdle(target.target.context->getDevice());
+    }
+}
+
+std::string WorkPartitioner::describeTarget(size_t target) const {
+    const PartitionTarget& partitionTarget = targets[target].target;
+    return std::string(partitionTarget.context->getDeviceProperties().deviceName) + " queue " +
+        std::to_string(partitionTarget.queueIndex);
+}
+
+std::vector<uint32_t> WorkPartitioner::split(uint32_t elements) const {
+    double totalWeight = 0.0;
+    for (const Target& target : targets) {
+        totalWeight += std::max(target.weight, 0.0);
+    }
+
+    std::vector<uint32_t> shares(targets.size(), 0);
+    uint32_t assigned = 0;
+    for (size_t i = 0; i + 1 < targets.size() && totalWeight > 0.0; ++i) {
+        const double fraction = std::max(targets[i].weight, 0.0) / totalWeight;
+        uint32_t share = static_cast<uint32_t>(elements * fraction);
+        share = share / shareGranularity * shareGranularity;
+        shares[i] = std::min(share, elements - assigned);
+        assigned += shares[i];
+    }
+    // Rounding leftovers go to the last target
+    shares.back() = elements - assigned;
+    return shares;
+}
+
+void WorkPartitioner::calibrate(uint32_t elements, uint32_t iterations) {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<uint32_t> input(elements);
+    for (uint32_t i = 0; i < elements; ++i) {
+        input[i] = i;
+    }
+
+    for (Target& target : targets) {
+        const uint32_t targetElements = std::min(elements, target.maxElements);
+        target.slot->reserve(targetElements);
+        memcpy(target.slot->getUploadData(), input.data(), targetElements * sizeof(uint32_t));
+
+        // One untimed run so first-use costs are not counted
+        target.slot->submit(targetElements);
+        target.slot->wait();
+
+        std::vector<double> samples(std::max(iterations, 1u));
+        for (double& sample : samples) {
+            auto start = Clock::now();
+            target.slot->submit(targetElements);
+            target.slot->wait();
+            sample = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        std::sort(samples.begin(), samples.end());
+        const double median = samples[samples.size() / 2];
+
+        target.weight = median > 0.0 ? targetElements / median : 1.0;
+    }
+}
+
+void WorkPartitioner::run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
+    const uint32_t elements = static_cast<uint32_t>(input.size());
+    const std::vector<uint32_t> shares = split(elements);
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (shares[i] > targets[i].maxElements) {
+            throw std::runtime_error("RUNTIME ERROR: Share for " + describeTarget(i) + " exceeds maxStorageBufferRange");
+        }
+    }
+
+    output.resize(elements);
+
+    // Submit every share before waiting on any, so the queues run in parallel
+    uint32_t offset = 0;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        Target& target = targets[i];
+        target.lastShare = shares[i];
+        if (shares[i] > 0) {
+            target.slot->reserve(shares[i]);
+            memcpy(target.slot->getUploadData(), input.data() + offset, shares[i] * sizeof(uint32_t));
+            target.slot->submit(shares[i]);
+        }
+        offset += shares[i];
+    }
+
+    offset = 0;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        Target& target = targets[i];
+        if (shares[i] > 0) {
+            target.slot->wait();
+            memcpy(output.data() + offset, target.slot->getReadbackData(shares[i]), shares[i] * sizeof(uint32_t));
+        }
+        offset += shares[i];
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "compute_context.hpp"
+#include "compute_kernel.hpp"
+#include "job_slot.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// One place a share of a job can run: a compute queue of a context, with the
+// kernel built on that context
+struct PartitionTarget {
+    ComputeContext* context = nullptr;
+    const ComputeKernel* kernel = nullptr;
+    uint32_t queueIndex = 0;
+};
+
+// Splits one job across several compute queues and devices. Each target gets
+// a contiguous share proportional to its weight; all shares are submitted
+// before any is waited on, so the targets run concurrently, and the results
+// are copied back into one output in input order. Weights start equal and
+// calibrate() sets them to the throughput each target reaches on its own.
+//
+// All recording and submission happens on the calling thread, so targets on
+// the same context can share its command and descriptor pools.
+class WorkPartitioner {
+public:
+    // Shares are multiples of this many elements, except the last one
+    static constexpr uint32_t shareGranularity = 256;
+
+    explicit WorkPartitioner(const std::vector<PartitionTarget>& targets);
+    ~WorkPartitioner();
+
+    WorkPartitioner(const WorkPartitioner&) = delete;
+    WorkPartitioner& operator=(const WorkPartitioner&) = delete;
+
+    // Times every target alone on a job of elements and weights it by the
+    // elements per second it reaches (median of iterations runs)
+    void calibrate(uint32_t elements = 1 << 22, uint32_t iterations = 5);
+    void run(const std::vector<uint32_t>& input, std::vector<uint32_t>& output);
+
+    size_t getTargetCount() const { return targets.size(); }
+    double getWeight(size_t target) const { return targets[target].weight; }
+    void setWeight(size_t target, double weight) { targets[target].weight = weight; }
+    // Elements the target received in the last run()
+    uint32_t getLastShare(size_t target) const { return targets[target].lastShare; }
+    // "<device name> queue <n>"
+    std::string describeTarget(size_t target) const;
+
+private:
+    struct Target {
+        PartitionTarget target;
+        std::unique_ptr<JobSlot> slot;
+        double weight = 1.0;
+        uint32_t lastShare = 0;
+        uint32_t maxElements = 0;
+    };
+
+    std::vector<uint32_t> split(uint32_t elements) const;
+
+    std::vector<Target> targets;
+};
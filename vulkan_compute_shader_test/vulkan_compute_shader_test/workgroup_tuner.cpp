@@ -0,0 +1,104 @@
+#include "workgroup_tuner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+
+WorkgroupTuner::WorkgroupTuner(const std::string& filepath)
+    : filepath(filepath) {
+    // One "<key> <size>" entry per line
+    std::ifstream file{ filepath };
+    std::string key;
+    uint32_t size;
+    while (file >> key >> size) {
+        tunedSizes[key] = size;
+    }
+}
+
+std::string WorkgroupTuner::makeKey(const ComputeContext& context, const std::string& shaderPath) {
+    const VkPhysicalDeviceProperties& properties = context.getDeviceProperties();
+    std::ostringstream key;
+    key << std::hex << properties.vendorID << ":" << properties.deviceID << ":" << properties.driverVersion << ":" <<
+        std::filesystem::path(shaderPath).filename().string();
+    return key.str();
+}
+
+std::vector<uint32_t> WorkgroupTuner::candidateSizes(const VkPhysicalDeviceLimits& limits) {
+    const uint32_t maxSize = ComputeKernel::maxWorkgroupSize(limits);
+
+    std::vector<uint32_t> sizes;
+    for (uint32_t size = 16; size <= maxSize; size *= 2) {
+        sizes.push_back(size);
+    }
+    if (sizes.empty()) {
+        sizes.push_back(maxSize);
+    }
+    return sizes;
+}
+
+bool WorkgroupTuner::lookup(const ComputeContext& context, const std::string& shaderPath, uint32_t& workgroupSize) const {
+    auto it = tunedSizes.find(makeKey(context, shaderPath));
+    if (it == tunedSizes.end() || it->second > ComputeKernel::maxWorkgroupSize(context.getDeviceProperties().limits)) {
+        return false;
+    }
+    workgroupSize = it->second;
+    return true;
+}
+
+uint32_t WorkgroupTuner::tune(const ComputeContext& context, ComputeKernel& kernel, const std::string& shaderPath,
+    uint32_t elements, uint32_t iterations) {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<uint32_t> input(elements);
+    for (uint32_t i = 0; i < elements; ++i) {
+        input[i] = i;
+    }
+    std::vector<uint32_t> output;
+
+    std::cout << "Tuning workgroup size (" << elements << " elements, " << iterations << " iterations):" << std::endl;
+
+    uint32_t bestSize = kernel.getWorkgroupSize();
+    double bestMicroseconds = 0.0;
+    for (uint32_t size : candidateSizes(context.getDeviceProperties().limits)) {
+        kernel.setWorkgroupSize(size);
+        // Warm up once so buffer allocation and first-use costs are not timed
+        kernel.run(input, output);
+
+        // The median is less sensitive to scheduling noise than the mean
+        std::vector<double> samples(iterations);
+        for (uint32_t i = 0; i < iterations; ++i) {
+            auto start = Clock::now();
+            kernel.run(input, output);
+            samples[i] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        }
+        std::sort(samples.begin(), samples.end());
+        const double median = samples[samples.size() / 2];
+
+        std::cout << "    local_size_x " << size << ": " << median << " us" << std::endl;
+        if (bestMicroseconds == 0.0 || median < bestMicroseconds) {
+            bestMicroseconds = median;
+            bestSize = size;
+        }
+    }
+
+    kernel.setWorkgroupSize(bestSize);
+    std::cout << "    Best: " << bestSize << std::endl << std::endl;
+
+    tunedSizes[makeKey(context, shaderPath)] = bestSize;
+    save();
+    return bestSize;
+}
+
+void WorkgroupTuner::save() const {
+    std::ofstream file{ filepath, std::ios::trunc };
+    for (const auto& entry : tunedSizes) {
+        file << entry.first << " " << entry.second << std::endl;
+    }
+    if (!file) {
+        std::cerr << "Workgroup tuner: failed to write " << filepath << std::endl;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "compute_kernel.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Finds the fastest local_size_x for a kernel on the current device by timing
+// each candidate, and remembers the result in a small text file so later runs
+// can start with the tuned size. Entries are keyed by device, driver version
+// and shader, since any of them can move the optimum.
+class WorkgroupTuner {
+public:
+    explicit WorkgroupTuner(const std::string& filepath);
+
+    bool lookup(const ComputeContext& context, const std::string& shaderPath, uint32_t& workgroupSize) const;
+    // Times every candidate on a job of the given size, leaves the kernel on the
+    // fastest one, stores it and returns it
+    uint32_t tune(const ComputeContext& context, ComputeKernel& kernel, const std::string& shaderPath,
+        uint32_t elements, uint32_t iterations);
+
+    static std::vector<uint32_t> candidateSizes(const VkPhysicalDeviceLimits& limits);
+
+private:
+    static std::string makeKey(const ComputeContext& context, const std::string& shaderPath);
+    void save() const;
+
+    std::string filepath;
+    std::map<std::string, uint32_t> tunedSizes;
+};